@@ -0,0 +1,473 @@
+// Benchmark for the Rate Monotonic engine: analyzeLine() from RMEngine.h,
+// which HW1 and HW3 run on every input line, the analysis behind the replies
+// of HW2Server and the whole path of a request frame through the server,
+// with and without its result cache. All are timed on the same generated
+// task sets, and every engine and configuration runs in a forked child of
+// its own, so its peak resident set size is not carried over from the cells
+// before it. HW2Server.cpp is included with its main renamed for its
+// analysis and frame handling.
+//
+// Task sets are drawn near the utilization asked for and the mean they
+// reach is shown as achieved. The time per tick and per interval covers only
+// the task sets that were simulated.
+//
+// Once warmed up, no engine may allocate while answering a task set. The
+// benchmark exits with status 1 if any did, so it can gate changes.
+//
+// Build: g++ -O2 -pthread -o Benchmark Benchmark.cpp
+// Usage: ./Benchmark [--tasks 2,4,8] [--utilization 0.5,0.7,0.9]
+//                    [--hyperperiods 3600,277200] [--periods divisors|harmonic|uniform]
+//                    [--sets N] [--seed S] [--per-tick]
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fcntl.h>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "RMEngine.h"
+
+// Number of heap allocations made so far
+std::atomic<unsigned long long> allocations{0};
+
+void* operator new(size_t size) {
+    allocations++;
+    void* memory = std::malloc(size > 0 ? size : 1);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+// Kept out of line so GCC does not pair the inlined free() with operator new
+__attribute__((noinline)) void operator delete(void* memory) noexcept { std::free(memory); }
+
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+#define main main_hw2
+#include "HW2Server.cpp"
+#undef main
+
+// Options of analyzeLine(), HW2Server keeps its own in options
+AnalysisOptions line_options;
+
+// How task periods are drawn, which decides the hyperperiod
+enum class PeriodDistribution { Divisors, Harmonic, Uniform };
+
+// Task names in order, skipping 'I' which marks idle time in the diagrams
+const std::string task_names = "ABCDEFGHJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+// Function to split a total utilization into n task utilizations with the
+// UUniFast algorithm, which draws uniformly from all such splits
+std::vector<double> uunifast(size_t n, double total, std::mt19937_64& rng) {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<double> utilizations(n);
+    double remaining = total;
+    for (size_t i = 1; i < n; ++i) {
+        double next = remaining * std::pow(uniform(rng), 1.0 / (n - i));
+        utilizations[i - 1] = remaining - next;
+        remaining = next;
+    }
+    utilizations[n - 1] = remaining;
+    return utilizations;
+}
+
+// Function to draw one period. Divisors picks a divisor of hyperperiod so the
+// task set hyperperiod never exceeds it, Harmonic picks hyperperiod divided by
+// a power of two and Uniform picks any value up to hyperperiod
+unsigned drawPeriod(PeriodDistribution distribution, unsigned hyperperiod,
+                    const std::vector<unsigned>& divisors, std::mt19937_64& rng) {
+    if (distribution == PeriodDistribution::Divisors) {
+        return divisors[rng() % divisors.size()];
+    }
+    if (distribution == PeriodDistribution::Harmonic) {
+        unsigned period = hyperperiod;
+        while (period % 2 == 0 && period > 2 && rng() % 2 == 0) {
+            period /= 2;
+        }
+        return period;
+    }
+    return 2 + rng() % (hyperperiod - 1);
+}
+
+// Function to generate one task set as an input line, with the utilization
+// it actually has in achieved. WCETs are whole ticks, so a task whose
+// utilization rounds to no tick at its period draws another period, up to a
+// limit, rather than taking one tick and overshooting
+std::string generateTaskSet(size_t n, double utilization, PeriodDistribution distribution,
+                            unsigned hyperperiod, const std::vector<unsigned>& divisors,
+                            std::mt19937_64& rng, double& achieved) {
+    std::vector<double> utilizations = uunifast(n, utilization, rng);
+    std::stringstream line;
+    achieved = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        unsigned period = drawPeriod(distribution, hyperperiod, divisors, rng);
+        for (int attempt = 0; attempt < 64 && utilizations[i] * period < 0.5; ++attempt) {
+            period = drawPeriod(distribution, hyperperiod, divisors, rng);
+        }
+        unsigned wcet = static_cast<unsigned>(std::lround(utilizations[i] * period));
+        wcet = std::min(period, std::max(1u, wcet));
+        achieved += static_cast<double>(wcet) / period;
+        line << (i > 0 ? " " : "") << task_names[i % task_names.size()] << " "
+             << wcet << " " << period;
+    }
+    return line.str();
+}
+
+// Function to generate a task set within tolerance of the utilization asked
+// for, keeping the closest of a number of attempts if none is
+std::string generateNearTaskSet(size_t n, double utilization, PeriodDistribution distribution,
+                                unsigned hyperperiod, const std::vector<unsigned>& divisors,
+                                std::mt19937_64& rng, double& achieved) {
+    const double tolerance = 0.02;
+    std::string best;
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        double drawn;
+        std::string line =
+            generateTaskSet(n, utilization, distribution, hyperperiod, divisors, rng, drawn);
+        if (best.empty() || std::abs(drawn - utilization) < std::abs(achieved - utilization)) {
+            best = std::move(line);
+            achieved = drawn;
+        }
+        if (std::abs(achieved - utilization) <= tolerance) {
+            break;
+        }
+    }
+    return best;
+}
+
+// Function to parse a comma separated list of numbers
+template <typename T>
+std::vector<T> parseList(const std::string& text) {
+    std::vector<T> values;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        values.push_back(static_cast<T>(std::strtod(item.c_str(), nullptr)));
+    }
+    return values;
+}
+
+// Struct to hold the measurements of one engine on one batch of task sets
+struct Measurement {
+    double seconds;
+    double simulated_seconds; // Spent on the task sets that were simulated
+    unsigned long long allocations;
+    size_t sink; // Sum of the engine results, so the calls are not optimized away
+};
+
+// Function to run engine on every input and measure it. A first untimed pass
+// lets the engine buffers grow to fit, so the measured pass shows the steady
+// state allocations. Each input is timed on its own, so the time of the
+// simulated ones, marked in simulated, can be set against their ticks
+template <typename Engine>
+Measurement measure(const std::vector<std::string>& inputs, const std::vector<bool>& simulated,
+                    Engine engine) {
+    size_t sink = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        sink += engine(inputs[i], i + 1);
+    }
+    unsigned long long allocations_before = allocations;
+    double seconds = 0.0;
+    double simulated_seconds = 0.0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        auto start = std::chrono::steady_clock::now();
+        sink += engine(inputs[i], i + 1);
+        auto end = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(end - start).count();
+        seconds += elapsed;
+        if (simulated[i]) {
+            simulated_seconds += elapsed;
+        }
+    }
+    return {seconds, simulated_seconds, allocations - allocations_before, sink};
+}
+
+// Struct to hold the simulated ticks, diagram intervals and encoded diagram
+// bytes of a batch of task sets
+struct DiagramCounts {
+    unsigned long long ticks = 0;
+    unsigned long long intervals = 0;
+    unsigned long long diagram_bytes = 0;
+    size_t simulated = 0;
+};
+
+// Function to build a version 4 request frame carrying one task set, as
+// HW2Client sends them
+std::string requestFrame(const std::string& input) {
+    std::string frame;
+    startFrame(frame, compact_version, 1);
+    putU32(frame, input.size());
+    frame += input;
+    return frame;
+}
+
+// Function to measure answering every input as a request frame, from
+// parsing the frame through the cache to writing the reply to /dev/null
+Measurement measureFrames(const std::vector<std::string>& inputs,
+                          const std::vector<bool>& simulated, bool cached) {
+    if (cached && !createCache(1024)) {
+        std::cerr << "Error creating the result cache" << std::endl;
+        _exit(1);
+    }
+    std::vector<std::string> requests;
+    for (const auto& input : inputs) {
+        requests.push_back(requestFrame(input));
+    }
+    int fd = open("/dev/null", O_WRONLY);
+    std::string buffer;
+    uint64_t frame_start = 0;
+    FrameCheck check;
+    FrameScratch scratch;
+    Session session;
+    SharedRings rings;
+    return measure(inputs, simulated, [&](const std::string&, size_t iteration) {
+        buffer.assign(requests[iteration - 1]);
+        answerFrames(fd, buffer, frame_start, check, scratch, session, rings);
+        return scratch.workspace.output.size();
+    });
+}
+
+// Function to run cell in a forked child and get back the plain struct it
+// returns through a pipe, with the peak resident set size of the child in KB
+// from wait4(). The child starts from the pages of this process, which only
+// holds the generated inputs. Returns false if the child failed
+template <typename Cell, typename Report>
+bool runInChild(Cell cell, Report& report, long& peak_rss) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        return false;
+    }
+    pid_t child = fork();
+    if (child < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (child == 0) {
+        close(fds[0]);
+        Report result = cell();
+        bool sent = write(fds[1], &result, sizeof(result)) == sizeof(result);
+        _exit(sent ? 0 : 1);
+    }
+    close(fds[1]);
+    bool received = read(fds[0], &report, sizeof(report)) == sizeof(report);
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(child, &status, 0, &usage) < 0) {
+        return false;
+    }
+    peak_rss = usage.ru_maxrss;
+    return received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> task_counts = {2, 4, 8, 16};
+    std::vector<double> utilizations = {0.5, 0.7, 0.9};
+    std::vector<unsigned> hyperperiods = {3600, 277200, 10810800};
+    PeriodDistribution distribution = PeriodDistribution::Divisors;
+    size_t sets = 50;
+    unsigned long long seed = 1;
+    bool per_tick = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--per-tick") {
+            per_tick = true;
+            continue;
+        }
+        ++i;
+        if (arg == "--tasks") {
+            task_counts = parseList<size_t>(value);
+        } else if (arg == "--utilization") {
+            utilizations = parseList<double>(value);
+        } else if (arg == "--hyperperiods") {
+            hyperperiods = parseList<unsigned>(value);
+        } else if (arg == "--sets") {
+            sets = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--seed") {
+            seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--periods" && value == "divisors") {
+            distribution = PeriodDistribution::Divisors;
+        } else if (arg == "--periods" && value == "harmonic") {
+            distribution = PeriodDistribution::Harmonic;
+        } else if (arg == "--periods" && value == "uniform") {
+            distribution = PeriodDistribution::Uniform;
+        } else {
+            std::cerr << "Unknown argument " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (sets == 0 || task_counts.empty() || utilizations.empty() || hyperperiods.empty()) {
+        std::cerr << "Nothing to benchmark" << std::endl;
+        return 1;
+    }
+    line_options.per_tick_simulation = per_tick;
+    options.per_tick_simulation = per_tick;
+
+    std::cout << std::left << std::setw(13) << "engine" << std::right << std::setw(6) << "tasks"
+              << std::setw(6) << "util" << std::setw(10) << "achieved" << std::setw(13) << "hyperperiod" << std::setw(12)
+              << "simulated" << std::setw(11) << "ns/tick" << std::setw(13) << "ns/interval"
+              << std::setw(12) << "allocs/set" << std::setw(14) << "peak RSS KB" << std::setw(16)
+              << "diagram B/run" << std::endl;
+
+    std::mt19937_64 rng(seed);
+    size_t sink = 0;
+    std::vector<std::string> allocating; // Engines that allocated once warm
+    for (unsigned hyperperiod : hyperperiods) {
+        std::vector<unsigned> divisors;
+        for (unsigned d = 2; d <= hyperperiod; ++d) {
+            if (hyperperiod % d == 0) {
+                divisors.push_back(d);
+            }
+        }
+        if (hyperperiod < 2) {
+            std::cerr << "Hyperperiods must be at least 2" << std::endl;
+            return 1;
+        }
+        for (size_t n : task_counts) {
+            for (double utilization : utilizations) {
+                std::vector<std::string> inputs;
+                double achieved = 0.0;
+                for (size_t i = 0; i < sets; ++i) {
+                    double drawn;
+                    inputs.push_back(generateNearTaskSet(n, utilization, distribution,
+                                                         hyperperiod, divisors, rng, drawn));
+                    achieved += drawn / sets;
+                }
+
+                // Count the simulated ticks, diagram intervals and encoded
+                // diagram bytes once, every engine produces the same diagrams
+                DiagramCounts counts;
+                long peak_rss;
+                bool counted = runInChild([&] {
+                    DiagramCounts counted;
+                    Workspace workspace;
+                    for (const auto& input : inputs) {
+                        Result result = calculations(input, workspace);
+                        if (result.status == ResultStatus::Schedulable) {
+                            counted.ticks += std::min(result.hyperperiod, options.window_end);
+                            counted.intervals += workspace.diagram.runs;
+                            counted.diagram_bytes += workspace.diagram.bytes.size();
+                            ++counted.simulated;
+                        }
+                    }
+                    return counted;
+                }, counts, peak_rss);
+                if (!counted) {
+                    std::cerr << "Error running a benchmark child" << std::endl;
+                    return 1;
+                }
+                unsigned long long ticks = counts.ticks;
+                unsigned long long intervals = counts.intervals;
+                unsigned long long diagram_bytes = counts.diagram_bytes;
+                size_t simulated = counts.simulated;
+
+                // Mark the task sets that get simulated, deciding them without
+                // a diagram keeps this process small
+                std::vector<bool> simulated_sets;
+                {
+                    Workspace workspace;
+                    options.skip_diagram = true;
+                    for (const auto& input : inputs) {
+                        simulated_sets.push_back(calculations(input, workspace).status ==
+                                                 ResultStatus::Schedulable);
+                    }
+                    options.skip_diagram = false;
+                }
+
+                // Every engine builds its buffers from scratch in its child
+                std::vector<std::pair<std::string, std::function<Measurement()>>> cells = {
+                    {"analyzeLine", [&] {
+                         Workspace workspace;
+                         return measure(inputs, simulated_sets,
+                                        [&](const std::string& input, size_t iteration) {
+                             analyzeLine(input, iteration, line_options, workspace);
+                             return workspace.output.size();
+                         });
+                     }},
+                    {"HW2Server", [&] {
+                         Workspace workspace;
+                         return measure(inputs, simulated_sets,
+                                        [&](const std::string& input, size_t) {
+                             calculations(input, workspace);
+                             return workspace.diagram.bytes.size();
+                         });
+                     }},
+                    {"frames", [&] { return measureFrames(inputs, simulated_sets, false); }},
+                    {"cached", [&] { return measureFrames(inputs, simulated_sets, true); }},
+                };
+                std::vector<std::pair<std::string, Measurement>> rows;
+                std::vector<long> peak_rss_kb;
+                for (const auto& cell : cells) {
+                    Measurement measurement;
+                    if (!runInChild(cell.second, measurement, peak_rss)) {
+                        std::cerr << "Error running a benchmark child" << std::endl;
+                        return 1;
+                    }
+                    sink += measurement.sink;
+                    if (measurement.allocations > 0) {
+                        allocating.push_back(cell.first);
+                    }
+                    rows.emplace_back(cell.first, measurement);
+                    peak_rss_kb.push_back(peak_rss);
+                }
+
+                for (size_t r = 0; r < rows.size(); ++r) {
+                    const auto& row = rows[r];
+                    double nanoseconds = row.second.simulated_seconds * 1e9;
+                    std::cout << std::left << std::setw(13) << row.first << std::right
+                              << std::setw(6) << n << std::setw(6) << std::fixed
+                              << std::setprecision(2) << utilization << std::setw(10)
+                              << std::setprecision(3) << achieved << std::setw(13)
+                              << hyperperiod << std::setw(12) << simulated << std::setw(11);
+                    if (ticks > 0) {
+                        std::cout << std::setprecision(3) << nanoseconds / ticks;
+                    } else {
+                        std::cout << "-";
+                    }
+                    std::cout << std::setw(13);
+                    if (intervals > 0) {
+                        std::cout << std::setprecision(1) << nanoseconds / intervals;
+                    } else {
+                        std::cout << "-";
+                    }
+                    std::cout << std::setw(12) << std::setprecision(1)
+                              << static_cast<double>(row.second.allocations) / sets
+                              << std::setw(14) << peak_rss_kb[r] << std::setw(16);
+                    if (intervals > 0) {
+                        std::cout << std::setprecision(2)
+                                  << static_cast<double>(diagram_bytes) / intervals;
+                    } else {
+                        std::cout << "-";
+                    }
+                    std::cout << std::endl;
+                }
+            }
+        }
+    }
+    if (!allocating.empty()) {
+        std::cerr << "Steady-state allocations in " << allocating.size() << " cells:";
+        for (const auto& engine : allocating) {
+            std::cerr << " " << engine;
+        }
+        std::cerr << std::endl;
+        return 1;
+    }
+    // Using the sink keeps the engine calls from being optimized away
+    return sink == 0;
+}
@@ -1,246 +1,492 @@
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <pthread.h>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unistd.h>
 #include <vector>
 
-// Struct to hold task information
-struct Task {
-    char name;
-    unsigned wcet;
-    unsigned period;
-    unsigned initial_wcet; // We need to store initial WCET for reset
-};
-
-// Struct to hold task interval information
-struct TaskInterval {
-    char name;
-    unsigned start;
-    unsigned end;
-    bool stopped; // Represents if the task was interrupted
-};
+#include "RMEngine.h"
 
 // Struct to hold arguments for pthread function
 struct Arguments {
-    std::string input;
+    std::string_view input;
     std::string* output;
     size_t iteration;
 
     // Constructor
-    Arguments(const std::string& in, std::string* out, size_t iter)
+    Arguments(std::string_view in, std::string* out, size_t iter)
         : input(in), output(out), iteration(iter) {}
 };
 
-// Function to calculate the greatest common divisor (GCD) using Euclidean algorithm
-unsigned long long gcd(unsigned long long a, unsigned long long b) {
-    while (b != 0) {
-        unsigned long long temp = b;
-        b = a % b;
-        a = temp;
+// Options of the line analysis
+AnalysisOptions options;
+
+// Number of CPUs to partition one global task list across, 0 reads one
+// pre-partitioned line per CPU
+size_t partition_cpus = 0;
+
+// Bin-packing heuristic that picks the CPU for each task when partitioning
+enum class FitHeuristic { First, Best, Worst };
+FitHeuristic fit_heuristic = FitHeuristic::First;
+
+// Only screens every line with the batch analysis, no simulation
+bool screen_only = false;
+
+// Function to check whether a task can join the tasks already on a CPU
+// without any of them missing a deadline
+bool admits(const std::vector<Task>& cpu, const Task& task) {
+    std::vector<Task> candidate(cpu);
+    candidate.push_back(task);
+    sortByPriority(candidate);
+
+    double utilization = 0.0;
+    for (const auto& t : candidate) {
+        utilization += static_cast<double>(t.initial_wcet) / t.period;
+    }
+    if (utilization > 1) {
+        return false;
+    }
+    if (hyperbolicBound(candidate)) {
+        return true;
     }
-    return a;
+    std::vector<unsigned long long> response_times;
+    return responseTimes(candidate, response_times);
 }
 
-// Function to calculate the least common multiple (LCM) using GCD
-unsigned long long lcm(unsigned long long a, unsigned long long b) {
-    return (a * b) / gcd(a, b);
-}
+// Struct to hold the admission threads of one partitioning, they stay up
+// for every task and check their CPUs each time round is advanced
+struct AdmissionPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t start; // A new round or stop
+    pthread_cond_t done;  // The last thread of a round finished
+    const std::vector<std::vector<Task>>* cpus;
+    std::vector<char>* admitted;
+    const Task* task = nullptr;
+    size_t round = 0;
+    size_t pending = 0; // Threads still checking the current round
+    size_t stride = 1;  // Threads sharing the CPUs, the caller included
+    bool stop = false;
+};
 
-// Function to compare tasks based on their periods
-bool compareTasks(const Task& a, const Task& b) {
-    return a.period < b.period;
-}
+// Struct to hold arguments for an admission check thread
+struct AdmissionArguments {
+    AdmissionPool* pool;
+    size_t first;
+};
 
-void outputInfo(std::stringstream & entropy_values_sstr, std::vector<Task> tasks, size_t iteration, unsigned hyperperiod, double utilization)
-{
-  entropy_values_sstr << "CPU " << iteration
-                      << "\nTask scheduling information: ";
-  for (size_t i = 0; i < tasks.size(); ++i) {
-      entropy_values_sstr << tasks[i].name << " (WCET: " << tasks[i].wcet
-                          << ", Period: " << tasks[i].period << ")";
-      if (i < tasks.size() - 1) {
-          entropy_values_sstr << ", ";
-      }
-  }
-  entropy_values_sstr << "\nTask set utilization: " << std::setprecision(2)
-                      << std::fixed << utilization;
-  entropy_values_sstr << "\nHyperperiod: " << hyperperiod;
+// Function to check every stride-th CPU starting at first for task
+void checkAdmission(const AdmissionPool& pool, const Task& task, size_t first, size_t stride) {
+    for (size_t cpu = first; cpu < pool.cpus->size(); cpu += stride) {
+        (*pool.admitted)[cpu] = admits((*pool.cpus)[cpu], task);
+    }
 }
 
-// Function to parse input and calculate hyperperiod, utilization, and generate scheduling diagram
-std::string parse(const std::string& input, size_t iteration) {
-    std::stringstream input_string(input);
-    std::stringstream entropy_values_sstr;
-    std::vector<Task> tasks;
-    char task_name;
-    unsigned task_wcet;
-    unsigned task_period;
+// Admission thread function, checks its CPUs once per round until stopped
+void* admission_function(void* arguments) {
+    AdmissionArguments* args = static_cast<AdmissionArguments*>(arguments);
+    AdmissionPool& pool = *args->pool;
+    size_t seen = 0;
+    while (true) {
+        pthread_mutex_lock(&pool.mutex);
+        while (pool.round == seen && !pool.stop) {
+            pthread_cond_wait(&pool.start, &pool.mutex);
+        }
+        if (pool.stop) {
+            pthread_mutex_unlock(&pool.mutex);
+            break;
+        }
+        seen = pool.round;
+        const Task& task = *pool.task;
+        size_t stride = pool.stride;
+        pthread_mutex_unlock(&pool.mutex);
+
+        checkAdmission(pool, task, args->first, stride);
 
-    // Parse input string
-    while (input_string >> task_name >> task_wcet >> task_period) {
-        tasks.push_back({task_name, task_wcet, task_period, task_wcet});
+        pthread_mutex_lock(&pool.mutex);
+        if (--pool.pending == 0) {
+            pthread_cond_signal(&pool.done);
+        }
+        pthread_mutex_unlock(&pool.mutex);
     }
+    return nullptr;
+}
 
-    // Calculate hyperperiod
-    unsigned hyperperiod = 1;
-    for (const auto& task : tasks) {
-        hyperperiod = lcm(hyperperiod, task.period);
+// Function to assign every task to one of cpu_count CPUs, taking tasks by
+// decreasing utilization and checking all candidate CPUs in parallel on
+// threads started once. The CPUs of a thread that cannot be started are
+// checked by the others. Returns false with the task in unassigned if it
+// fits on no CPU
+bool partitionTasks(std::vector<Task> tasks, size_t cpu_count, FitHeuristic heuristic,
+                    std::vector<std::vector<Task>>& cpus, Task& unassigned) {
+    std::sort(tasks.begin(), tasks.end(), [](const Task& a, const Task& b) {
+        return static_cast<double>(a.wcet) / a.period > static_cast<double>(b.wcet) / b.period;
+    });
+
+    cpus.assign(cpu_count, std::vector<Task>());
+    std::vector<double> loads(cpu_count, 0.0);
+    std::vector<char> admitted(cpu_count);
+
+    AdmissionPool pool;
+    pthread_mutex_init(&pool.mutex, nullptr);
+    pthread_cond_init(&pool.start, nullptr);
+    pthread_cond_init(&pool.done, nullptr);
+    pool.cpus = &cpus;
+    pool.admitted = &admitted;
+
+    // The calling thread checks the first share itself
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = std::min(cpu_count, static_cast<size_t>(cores > 0 ? cores : 1));
+    std::vector<pthread_t> threads(workers);
+    std::vector<AdmissionArguments> arg_objects(workers);
+    size_t started = 0;
+    for (size_t i = 1; i < workers; ++i) {
+        arg_objects[i] = {&pool, i};
+        if (pthread_create(&threads[i], nullptr, admission_function, &arg_objects[i]) != 0) {
+            break;
+        }
+        ++started;
     }
+    pool.stride = started + 1;
 
-    // Calculate utilization
-    double utilization = 0.0;
+    bool assigned = true;
     for (const auto& task : tasks) {
-        utilization += static_cast<double>(task.wcet) / task.period;
-    }
+        pthread_mutex_lock(&pool.mutex);
+        pool.task = &task;
+        pool.pending = started;
+        ++pool.round;
+        pthread_cond_broadcast(&pool.start);
+        pthread_mutex_unlock(&pool.mutex);
 
-    // Output task scheduling information
-   outputInfo(entropy_values_sstr, tasks, iteration, hyperperiod, utilization);
+        checkAdmission(pool, task, 0, pool.stride);
 
-  // Sort tasks based on their periods
-  std::sort(tasks.begin(), tasks.end(), compareTasks);
+        pthread_mutex_lock(&pool.mutex);
+        while (pool.pending > 0) {
+            pthread_cond_wait(&pool.done, &pool.mutex);
+        }
+        pthread_mutex_unlock(&pool.mutex);
 
-    // Check schedulability
-    double threshold = tasks.size() * (std::pow(2.0, 1.0 / tasks.size()) - 1);
-    if (utilization > 1) {
-        entropy_values_sstr << "\nRate Monotonic Algorithm execution for CPU"
-            << iteration << ":" << "\nThe task set is not schedulable";
-    } else if (utilization > threshold || utilization < 0) {
-        entropy_values_sstr <<"\nRate Monotonic Algorithm execution for CPU"
-            << iteration << ":" << "\nTask set schedulability is unknown";
-    } else {
-        entropy_values_sstr << "\nRate Monotonic Algorithm execution for CPU"
-                            << iteration << ":";
-
-        // Generate scheduling diagram
-        std::vector<TaskInterval> task_intervals;
-        for (unsigned tick = 0; tick < hyperperiod; ++tick) {
-            bool task_running = false;
-            for (auto& task : tasks) {
-                if (tick % task.period == 0) {
-                    task.wcet = task.initial_wcet; // Reset WCET
-                    for (auto& interval : task_intervals) {
-                        //if (interval.name == task.name) {
-                            interval.stopped = true; // Reset stopped flag
-                        //}
-                    }
-                }
+        // Pick the first, fullest or emptiest CPU that admits the task
+        size_t chosen = cpu_count;
+        for (size_t cpu = 0; cpu < cpu_count; ++cpu) {
+            if (!admitted[cpu]) {
+                continue;
             }
-            for (auto& task : tasks) {
-                if (task.wcet > 0) {
-                    task_running = true;
-                    if (task.wcet == task.initial_wcet) {
-                        // Fresh task, create new interval
-                        task_intervals.push_back({task.name, tick, tick + 1, false});
-                    } else {
-                        // Task still running, extend interval or create new one
-                        bool found = false;
-                        for (auto& interval : task_intervals) {
-                            if (interval.name == task.name && !interval.stopped) {
-                                interval.end = tick + 1; // Extend interval
-                                found = true;
-                                break;
-                            }
-                        }
-                        if (!found) {
-                            task_intervals.push_back({task.name, tick, tick + 1, false});
-                        }
-                    }
-                    --task.wcet;
-                    break; // Move to next tick
-                }
+            if (chosen == cpu_count
+                || (heuristic == FitHeuristic::Best && loads[cpu] > loads[chosen])
+                || (heuristic == FitHeuristic::Worst && loads[cpu] < loads[chosen])) {
+                chosen = cpu;
             }
-            if (!task_running) {
-                // No task is running at this time, insert idle interval
-                task_intervals.push_back({'I', tick, tick + 1, false});
+            if (heuristic == FitHeuristic::First) {
+                break;
             }
         }
-
-        // Merge adjacent idle intervals
-        for (size_t i = 0; i < task_intervals.size() - 1; ++i) {
-            if (task_intervals[i].name == 'I' && task_intervals[i + 1].name == 'I') {
-                // Merge adjacent idle intervals
-                task_intervals[i].end = task_intervals[i + 1].end;
-                task_intervals.erase(task_intervals.begin() + i + 1);
-                --i; // Adjust index after erasing
-            }
+        if (chosen == cpu_count) {
+            unassigned = task;
+            assigned = false;
+            break;
         }
+        cpus[chosen].push_back(task);
+        loads[chosen] += static_cast<double>(task.wcet) / task.period;
+    }
 
-        // Generate scheduling diagram string
-        std::string diagram = "Scheduling Diagram for CPU " + std::to_string(iteration) + ": ";
-        char last_task = ' ';
-        for (const auto& interval : task_intervals) {
-            if (interval.name != 'I') {
-                diagram += interval.name;
-                diagram += "(" + std::to_string(interval.end - interval.start) + "), ";
-                last_task = interval.name;
-            } else {
-                if (last_task != 'I') {
-                    diagram += "Idle(" + std::to_string(interval.end - interval.start) + "), ";
-                    last_task = 'I';
-                }
-            }
+    // Stop the admission threads
+    pthread_mutex_lock(&pool.mutex);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.mutex);
+    for (size_t i = 1; i <= started; ++i) {
+        pthread_join(threads[i], nullptr);
+    }
+    pthread_mutex_destroy(&pool.mutex);
+    pthread_cond_destroy(&pool.start);
+    pthread_cond_destroy(&pool.done);
+    return assigned;
+}
+
+// Many task sets in structure-of-arrays layout, the tasks of set i are
+// wcet[offsets[i]] .. wcet[offsets[i + 1] - 1] and likewise for period
+struct TaskSetBatch {
+    std::vector<unsigned> wcet;
+    std::vector<unsigned> period;
+    std::vector<size_t> offsets{0};
+
+    void add(std::string_view input) {
+        size_t position = 0;
+        Task task;
+        ParseError error;
+        while (nextTask(input, position, task, error)) {
+            wcet.push_back(task.wcet);
+            period.push_back(task.period);
+        }
+        if (error.message != nullptr) {
+            std::cerr << parseErrorText("CPU " + std::to_string(size() + 1), error);
         }
-        // Remove trailing comma and space
-        diagram.pop_back();
-        diagram.pop_back();
+        offsets.push_back(wcet.size());
+    }
 
-        entropy_values_sstr << "\n" << diagram;
+    size_t size() const { return offsets.size() - 1; }
+};
+
+// Struct to hold the batch analysis of one task set
+struct BatchResult {
+    double utilization;
+    unsigned long long hyperperiod;
+    bool below_bound; // Utilization is within the Liu-Layland bound
+};
+
+// Four doubles handled by one SIMD operation
+typedef double double4 __attribute__((vector_size(4 * sizeof(double))));
+
+// Function to analyze every task set of a batch. The per-task utilizations
+// are divided four at a time and then summed per set in task order, so every
+// value is bit-identical to the scalar path in analyzeLine()
+void analyzeBatch(const TaskSetBatch& batch, std::vector<BatchResult>& results) {
+    size_t count = batch.wcet.size();
+    std::vector<double> ratios(count);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const unsigned* w = &batch.wcet[i];
+        const unsigned* p = &batch.period[i];
+        double4 wcets = {(double)w[0], (double)w[1], (double)w[2], (double)w[3]};
+        double4 periods = {(double)p[0], (double)p[1], (double)p[2], (double)p[3]};
+        double4 quotients = wcets / periods;
+        std::memcpy(&ratios[i], &quotients, sizeof(quotients));
+    }
+    for (; i < count; ++i) {
+        ratios[i] = static_cast<double>(batch.wcet[i]) / batch.period[i];
     }
 
-    return entropy_values_sstr.str();
+    results.resize(batch.size());
+    for (size_t set = 0; set < batch.size(); ++set) {
+        double utilization = 0.0;
+        unsigned long long hyperperiod = 1;
+        for (size_t task = batch.offsets[set]; task < batch.offsets[set + 1]; ++task) {
+            utilization += ratios[task];
+            hyperperiod = lcm(hyperperiod, batch.period[task]);
+        }
+        double threshold = liuLaylandThreshold(batch.offsets[set + 1] - batch.offsets[set]);
+        results[set] = {utilization, hyperperiod,
+                        utilization <= threshold && utilization >= 0};
+    }
 }
 
-// Thread function
-void* thread_function(void* arguments) {
-    Arguments* args = static_cast<Arguments*>(arguments);
-    std::string input = args->input;
-    std::string* output = args->output;
-    size_t iteration = args->iteration;
+// Function to analyze one line on the calling pool worker's workspace. The
+// output buffer is handed over instead of copied, and the next line gets a
+// buffer of the same size so it is not grown again piece by piece
+void thread_function(Arguments& args, Workspace& workspace) {
+    analyzeLine(args.input, args.iteration, options, workspace);
+    args.output->swap(workspace.output);
+    workspace.output.reserve(args.output->capacity());
+}
 
-    *output = parse(input, iteration);
+// Struct to hold one pool worker's queue of input indices, the owner takes
+// work from the front and idle workers steal from the back
+struct WorkQueue {
+    pthread_mutex_t mutex;
+    std::deque<size_t> indices;
+};
+
+// Struct to hold arguments for a pool worker thread
+struct PoolArguments {
+    std::vector<Arguments>* jobs;
+    std::vector<WorkQueue>* queues;
+    size_t self;
+};
+
+// Function to take one index from a work queue, returns false if it is empty
+bool takeWork(WorkQueue& queue, bool from_front, size_t& index) {
+    pthread_mutex_lock(&queue.mutex);
+    bool found = !queue.indices.empty();
+    if (found) {
+        if (from_front) {
+            index = queue.indices.front();
+            queue.indices.pop_front();
+        } else {
+            index = queue.indices.back();
+            queue.indices.pop_back();
+        }
+    }
+    pthread_mutex_unlock(&queue.mutex);
+    return found;
+}
 
+// Pool worker function, runs its own lines first and then steals lines from
+// the other workers until every queue is empty
+void* worker_function(void* arguments) {
+    PoolArguments* args = static_cast<PoolArguments*>(arguments);
+    std::vector<WorkQueue>& queues = *args->queues;
+    analysis_worker = queues.size() > 1;
+    Workspace workspace;
+    size_t index;
+    while (true) {
+        bool found = takeWork(queues[args->self], true, index);
+        for (size_t i = 1; !found && i < queues.size(); ++i) {
+            found = takeWork(queues[(args->self + i) % queues.size()], false, index);
+        }
+        if (!found) {
+            break;
+        }
+        thread_function((*args->jobs)[index], workspace);
+    }
     return nullptr;
 }
 
-// Function to get inputs from user
-std::vector<std::string> get_inputs() {
-    std::vector<std::string> inputs;
-    std::string input;
-  for (int i = 0; i < 3; i++) {
-    std::getline(std::cin, input);
-    if (!input.empty()) {
-      inputs.push_back(input);
+// Function to get one global task list from every line of the user input
+std::vector<Task> get_task_list(const std::vector<std::string_view>& lines) {
+    std::vector<Task> tasks;
+    ParseError error;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (!parseTasks(lines[i], tasks, error)) {
+            std::cerr << parseErrorText("line " + std::to_string(i + 1), error);
+        }
     }
-  }
-    // while (std::getline(std::cin, input)) {
-    //     if (!input.empty()) {
-    //         inputs.push_back(input);
-    //     }
-    // }
-    return inputs;
+    return tasks;
 }
 
-int main() {
-    const std::vector<std::string> inputs = get_inputs();
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        OptionStatus status = readAnalysisOption(argc, argv, i, options);
+        if (status == OptionStatus::Invalid) {
+            return 1;
+        }
+        if (status == OptionStatus::Read) {
+            continue;
+        }
+        std::string arg = argv[i];
+        if (arg == "--screen") {
+            screen_only = true;
+        } else if (arg == "--partition") {
+            partition_cpus = i + 1 < argc ? std::strtoul(argv[++i], nullptr, 10) : 0;
+            if (partition_cpus == 0) {
+                std::cerr << "--partition expects a CPU count" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--fit") {
+            std::string fit = i + 1 < argc ? argv[++i] : "";
+            if (fit == "first") {
+                fit_heuristic = FitHeuristic::First;
+            } else if (fit == "best") {
+                fit_heuristic = FitHeuristic::Best;
+            } else if (fit == "worst") {
+                fit_heuristic = FitHeuristic::Worst;
+            } else {
+                std::cerr << "--fit expects first, best or worst" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    MappedFile mapped;
+    std::vector<std::string> stdin_lines;
+    std::vector<std::string_view> lines;
+    if (!readLines(options.input_path, mapped, stdin_lines, lines)) {
+        std::cerr << "Error mapping " << options.input_path << std::endl;
+        return 1;
+    }
+
+    if (screen_only) {
+        // Report utilization, hyperperiod and the bound test for every line
+        TaskSetBatch batch;
+        for (std::string_view input : lines) {
+            batch.add(input);
+        }
+        std::vector<BatchResult> results;
+        analyzeBatch(batch, results);
+        std::stringstream report;
+        for (size_t i = 0; i < results.size(); ++i) {
+            report << "CPU " << i + 1 << ": utilization " << std::setprecision(2)
+                   << std::fixed << results[i].utilization << ", hyperperiod ";
+            if (results[i].hyperperiod > max_hyperperiod) {
+                report << "too large";
+            } else {
+                report << results[i].hyperperiod;
+            }
+            report << (results[i].utilization > 1 ? ", not schedulable\n"
+                       : results[i].below_bound ? ", Liu-Layland bound met\n"
+                       : ", Liu-Layland bound exceeded\n");
+        }
+        std::cout << report.str();
+        unmapFile(mapped);
+        return 0;
+    }
+
+    std::vector<std::string_view> inputs;
+    std::vector<std::string> cpu_lines;
+    std::vector<size_t> cpu_numbers;
+    if (partition_cpus > 0) {
+        // Build one input line per non-empty CPU from the global task list
+        std::vector<Task> tasks = get_task_list(lines);
+        std::vector<std::vector<Task>> cpus;
+        Task unassigned;
+        if (!partitionTasks(tasks, partition_cpus, fit_heuristic, cpus, unassigned)) {
+            std::cout << "Task " << unassigned.name << " (WCET: " << unassigned.wcet
+                      << ", Period: " << unassigned.period << ") does not fit on any of the "
+                      << partition_cpus << " CPUs" << std::endl;
+            return 1;
+        }
+        std::cout << "Partition of " << tasks.size() << " tasks across "
+                  << partition_cpus << " CPUs:";
+        for (size_t cpu = 0; cpu < cpus.size(); ++cpu) {
+            std::stringstream line;
+            for (const auto& task : cpus[cpu]) {
+                line << (line.tellp() > 0 ? " " : "") << task.name << " "
+                     << task.wcet << " " << task.period;
+            }
+            std::cout << "\nCPU " << cpu + 1 << ": "
+                      << (cpus[cpu].empty() ? "unused" : line.str());
+            if (!cpus[cpu].empty()) {
+                cpu_lines.push_back(line.str());
+                cpu_numbers.push_back(cpu + 1);
+            }
+        }
+        inputs.assign(cpu_lines.begin(), cpu_lines.end());
+        std::cout << "\n\n\n";
+    } else {
+        inputs = lines;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            cpu_numbers.push_back(i + 1);
+        }
+    }
+
     std::vector<std::string> outputs(inputs.size());
-    std::vector<pthread_t> threads(inputs.size());
     std::vector<Arguments> arg_objects;
 
     // Prepare arguments
     for (size_t i = 0; i < inputs.size(); ++i) {
-        arg_objects.emplace_back(inputs[i], &outputs[i], i + 1);
+        arg_objects.emplace_back(inputs[i], &outputs[i], cpu_numbers[i]);
+    }
+
+    // Size the pool to the hardware and deal the lines out round-robin
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = std::min(inputs.size(), static_cast<size_t>(cores > 0 ? cores : 1));
+    std::vector<WorkQueue> queues(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        pthread_mutex_init(&queues[i].mutex, nullptr);
     }
-    // Create threads
     for (size_t i = 0; i < inputs.size(); ++i) {
-        pthread_create(&threads[i], nullptr, thread_function, &arg_objects[i]);
+        queues[i % workers].indices.push_back(i);
+    }
+
+    // Create threads
+    std::vector<pthread_t> threads(workers);
+    std::vector<PoolArguments> pool_args(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        pool_args[i] = {&arg_objects, &queues, i};
+        pthread_create(&threads[i], nullptr, worker_function, &pool_args[i]);
     }
 
     // Wait for threads to finish
-    for (size_t i = 0; i < inputs.size(); ++i) {
+    for (size_t i = 0; i < workers; ++i) {
         pthread_join(threads[i], nullptr);
+        pthread_mutex_destroy(&queues[i].mutex);
     }
 
   // Print outputs
@@ -250,6 +496,7 @@ int main() {
           std::cout << "\n\n\n";
       }
   }
+    unmapFile(mapped);
     return 0;
 }
 // version 5 where everything is in the correct order except for the interrupt for B isnt working yet
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <netdb.h>
@@ -12,10 +15,18 @@
 #include <strings.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <vector>
 
+#include "HW2Protocol.h"
+#include "RMEngine.h"
+#include "SharedRing.h"
+
+// Connects over TCP even when the server runs on this host
+bool force_tcp = false;
+
 // Struct to hold arguments for pthread function
 struct Arguments {
   std::string input;
@@ -41,15 +52,9 @@ struct Arguments {
   //     portno(pNum) {}
 };
 
-struct Task {
-  char name;
-  unsigned wcet;
-  unsigned period;
-  unsigned initial_wcet; // We need to store initial WCET for reset
-};
-
-void outputInfo(std::stringstream &entropy_values_sstr, std::vector<Task> tasks,
-                size_t iteration, unsigned hyperperiod, double utilization) {
+void outputInfo(std::stringstream &entropy_values_sstr,
+                const std::vector<Task> &tasks, size_t iteration,
+                const std::string &hyperperiod, double utilization) {
   entropy_values_sstr << "CPU " << iteration
                       << "\nTask scheduling information: ";
   for (size_t i = 0; i < tasks.size(); ++i) {
@@ -64,33 +69,182 @@ void outputInfo(std::stringstream &entropy_values_sstr, std::vector<Task> tasks,
   entropy_values_sstr << "\nHyperperiod: " << hyperperiod << "\n";
 }
 
-//Function below is based off of Rincon boiler plate client.cpp file
+// Struct to hold the result of the analysis of one task set
+struct Result {
+  ResultStatus status;
+  double utilization;
+  uint64_t hyperperiod; // 0 if it is too large to simulate
+  uint32_t runs;
+  std::string diagram; // The bytes of a CompactDiagram
+};
 
-// Thread function
-void *thread_function(void *arguments) {
-  Arguments *args = static_cast<Arguments *>(arguments);
+// Struct to hold a connection to the server: its socket, its shared-memory
+// rings once attached, and the reply bytes read ahead of the parser so the
+// small fields of a reply do not cost a read each
+struct Channel {
+  int fd = -1;
+  SharedRings rings;
+  char buffer[4096];
+  size_t begin = 0;
+  size_t end = 0;
+};
 
-  std::string input = args->input;
-  std::string *output = args->output;
-  size_t iteration = args->iteration;
-  int portno;
+// Function to write a whole buffer, retrying on short writes
+bool writeAll(Channel &channel, const char *data, size_t size) {
+  if (channel.rings.attached()) {
+    return ringWrite(channel.rings.requests, data, size, channel.fd);
+  }
+  while (size > 0) {
+    ssize_t n = write(channel.fd, data, size);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Function to read exactly size bytes, retrying on short reads
+bool readAll(Channel &channel, char *data, size_t size) {
+  while (size > 0) {
+    if (channel.begin == channel.end) {
+      ssize_t n =
+          channel.rings.attached()
+              ? (ssize_t)ringRead(channel.rings.replies, channel.buffer,
+                                  sizeof(channel.buffer), channel.fd)
+              : read(channel.fd, channel.buffer, sizeof(channel.buffer));
+      if (n <= 0) {
+        return false;
+      }
+      channel.begin = 0;
+      channel.end = n;
+    }
+    size_t n = std::min(size, channel.end - channel.begin);
+    memcpy(data, channel.buffer + channel.begin, n);
+    channel.begin += n;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Functions to read big-endian integers from the socket
+bool readU32(Channel &channel, uint32_t &value) {
+  char bytes[4];
+  if (!readAll(channel, bytes, sizeof(bytes))) {
+    return false;
+  }
+  value = getU32(bytes);
+  return true;
+}
+
+bool readU64(Channel &channel, uint64_t &value) {
+  uint32_t high, low;
+  if (!readU32(channel, high) || !readU32(channel, low)) {
+    return false;
+  }
+  value = (uint64_t)high << 32 | low;
+  return true;
+}
+
+// Function to read the header of a reply frame of a version and its count
+bool readHeader(Channel &channel, unsigned char version, uint32_t &count) {
+  char header[sizeof(protocol_magic) + 1];
+  return readAll(channel, header, sizeof(header)) &&
+         frameHeaderIs(header, version) && readU32(channel, count);
+}
+
+// Function to build a request frame for the input lines [first, last)
+std::string requestFrame(const std::vector<std::string> &inputs, size_t first,
+                         size_t last) {
+  std::string frame;
+  startFrame(frame, compact_version, last - first);
+  for (size_t i = first; i < last; ++i) {
+    putU32(frame, inputs[i].size());
+    frame += inputs[i];
+  }
+  return frame;
+}
+
+// Function to read a reply frame with count results, exits on failure
+void readReply(Channel &channel, size_t count, std::vector<Result> &results) {
+  uint32_t reply_count;
+  if (!readHeader(channel, compact_version, reply_count) ||
+      reply_count != count) {
+    std::cerr << "ERROR reading from socket" << std::endl;
+    exit(0);
+  }
 
-  int sockfd, n;
-  portno = std::atoi(args->portno); // argv[2]
-  std::string buffer = args->input;
+  results.resize(count);
+  for (auto &result : results) {
+    unsigned char status;
+    uint64_t utilization_bits;
+    uint32_t size;
+    if (!readAll(channel, (char *)&status, 1) ||
+        !readU64(channel, utilization_bits) ||
+        !readU64(channel, result.hyperperiod) ||
+        !readU32(channel, result.runs) || !readU32(channel, size)) {
+      std::cerr << "ERROR reading from socket" << std::endl;
+      exit(0);
+    }
+    result.status = (ResultStatus)status;
+    memcpy(&result.utilization, &utilization_bits, sizeof(double));
+    result.diagram.resize(size);
+    if (!readAll(channel, &result.diagram[0], size)) {
+      std::cerr << "ERROR reading from socket" << std::endl;
+      exit(0);
+    }
+  }
+}
+
+//Function below is based off of Rincon boiler plate client.cpp file
+
+// Function to connect to the AF_UNIX socket of a server on this host that
+// runs as the same user, returns -1 if there is none
+int connectUnix(const char *port) {
+  std::string path = unixSocketPath(port, false);
+  if (path.empty()) {
+    return -1;
+  }
+  struct sockaddr_un unix_addr;
+  bzero((char *)&unix_addr, sizeof(unix_addr));
+  unix_addr.sun_family = AF_UNIX;
+  strncpy(unix_addr.sun_path, path.c_str(), sizeof(unix_addr.sun_path) - 1);
+  int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sockfd >= 0 &&
+      (connect(sockfd, (struct sockaddr *)&unix_addr, sizeof(unix_addr)) < 0 ||
+       !peerIsUser(sockfd))) {
+    close(sockfd);
+    sockfd = -1;
+  }
+  return sockfd;
+}
+
+// Function to open a connection to the server, exits on failure. A server on
+// a loopback address is reached over its AF_UNIX socket when it has one
+int connectToServer(const char *serverIP, const char *port) {
+  int sockfd, portno;
   struct sockaddr_in serv_addr;
   struct hostent *server;
 
+  server = gethostbyname(serverIP); // server = gethostbyname(argv[1]);
+  if (server == NULL) {
+    std::cerr << "ERROR, no such host" << std::endl;
+    exit(0);
+  }
+  if (!force_tcp && server->h_addrtype == AF_INET &&
+      (unsigned char)server->h_addr[0] == 127 &&
+      (sockfd = connectUnix(port)) >= 0) {
+    return sockfd;
+  }
+
+  portno = std::atoi(port); // argv[2]
   sockfd = socket(AF_INET, SOCK_STREAM, 0);
   if (sockfd < 0) {
     std::cerr << "ERROR opening socket" << std::endl;
     exit(0);
   }
-  server = gethostbyname(args->serverIP); // server = gethostbyname(argv[1]);
-  if (server == NULL) {
-    std::cerr << "ERROR, no such host" << std::endl;
-    exit(0);
-  }
   bzero((char *)&serv_addr, sizeof(serv_addr));
   serv_addr.sin_family = AF_INET;
   bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr,
@@ -100,126 +254,393 @@ void *thread_function(void *arguments) {
     std::cerr << "ERROR connecting" << std::endl;
     exit(0);
   }
+  return sockfd;
+}
 
-  int msgSize = sizeof(buffer);
-  n = write(sockfd, &msgSize, sizeof(int));
-  if (n < 0) {
-    std::cerr << "ERROR writing to socket" << std::endl;
-    exit(0);
+// Function to build the output for one CPU from its input line and the
+// analysis result sent by the server
+std::string formatResult(const std::string &input, size_t iteration,
+                         const Result &result) {
+  std::string output;
+  std::vector<Task> tasks;
+
+  // The server analyzes a malformed line up to the error, so the same tasks
+  // are shown here
+  ParseError error;
+  if (!parseTasks(input, tasks, error)) {
+    std::cerr << parseErrorText("CPU " + std::to_string(iteration), error);
   }
-  n = write(sockfd, buffer.c_str(), msgSize);
-  if (n < 0) {
-    std::cerr << "ERROR writing to socket" << std::endl;
-    exit(0);
+
+  std::string hyperperiod = result.hyperperiod == 0
+                                ? "too large"
+                                : std::to_string(result.hyperperiod);
+
+  std::stringstream info;
+  outputInfo(info, tasks, iteration, hyperperiod, result.utilization);
+
+  output += info.str();
+  output += "Rate Monotonic Algorithm execution for CPU " +
+            std::to_string(iteration) + ":";
+
+  if (result.status == ResultStatus::NotSchedulable) {
+    output += "\nThe task set is not schedulable";
+  } else if (result.status == ResultStatus::Unknown) {
+    output += "\nTask set schedulability is unknown";
+  } else if (result.status == ResultStatus::HyperperiodTooLarge) {
+    output += "\nHyperperiod too large to simulate, use --window";
+  } else {
+    output += "\nScheduling Diagram for CPU " + std::to_string(iteration) + ": ";
+    uint32_t runs = 0;
+    bool whole = forEachRun(
+        result.diagram.data(), result.diagram.size(),
+        [&](const DiagramRun &run) {
+          if (runs++ > 0) {
+            output += ", ";
+          }
+          output += run.name == 'I' ? std::string("Idle") : std::string(1, run.name);
+          output += "(" + std::to_string(run.length) + ")";
+        });
+    if (!whole || runs != result.runs) {
+      std::cerr << "ERROR malformed diagram from server" << std::endl;
+      exit(0);
+    }
   }
-  n = read(sockfd, &msgSize, sizeof(int));
-  if (n < 0) {
+
+  return output;
+}
+
+// Function to move a connection to a server on this host onto shared-memory
+// rings, so bulk frames and replies skip the socket. The rings are created
+// here and named to the server in a version 3 frame, and the name is removed
+// again once the server answered. Keeps using the socket if anything fails
+void attachRings(Channel &channel) {
+  if (!isUnixSocket(channel.fd)) {
+    return;
+  }
+  std::string name = "/HW2Client." + std::to_string(getpid()) + "." +
+                     std::to_string(channel.fd);
+  SharedRings rings;
+  if (!createSharedRings(name, rings)) {
+    return;
+  }
+  std::string frame;
+  startFrame(frame, ring_version, 1);
+  putU32(frame, name.size());
+  frame += name;
+
+  uint32_t reply_count;
+  unsigned char status;
+  bool answered = writeAll(channel, frame.data(), frame.size()) &&
+                  readHeader(channel, ring_version, reply_count) &&
+                  reply_count == 1 && readAll(channel, (char *)&status, 1);
+  shm_unlink(name.c_str());
+  if (!answered) {
     std::cerr << "ERROR reading from socket" << std::endl;
     exit(0);
   }
-  char *tempBuffer = new char[msgSize + 1];
-  bzero(tempBuffer, msgSize + 1);
-  n = read(sockfd, tempBuffer, msgSize);
-  if (n < 0) {
-    std::cerr << "ERROR reading from socket"  << std::endl;
-    exit(0);
+  if (status == 0) {
+    channel.rings = rings;
+  } else {
+    unmapSharedRings(rings);
   }
-  buffer = tempBuffer;
-  delete[] tempBuffer;
+}
 
-  close(sockfd);
+// Thread function
+void *thread_function(void *arguments) {
+  Arguments *args = static_cast<Arguments *>(arguments);
 
-  std::vector<Task> tasks;
+  const std::string &input = args->input;
+  std::string *output = args->output;
+  size_t iteration = args->iteration;
+
+  std::vector<Result> results;
 
-  char task_name;
-  unsigned task_wcet;
-  unsigned task_period;
-  unsigned initial_wcet;
-  std::stringstream ss(input);
+  Channel channel;
+  channel.fd = connectToServer(args->serverIP, args->portno);
 
-  while (ss >> task_name >> task_wcet >> task_period) {
-    tasks.push_back({task_name, task_wcet, task_period, task_wcet});
+  std::string frame = requestFrame({input}, 0, 1);
+  if (!writeAll(channel, frame.data(), frame.size())) {
+    std::cerr << "ERROR writing to socket" << std::endl;
+    exit(0);
   }
+  readReply(channel, 1, results);
 
-  std::string resultString = buffer;
+  close(channel.fd);
 
-  // Find the position of the first space
-  size_t spacePos = resultString.find(' ');
+  (*output) += formatResult(input, iteration, results[0]);
 
-  // Extract the first part as a double
-  double utility = std::stod(resultString.substr(0, spacePos));
+  return nullptr;
+}
 
-  // Find the next space position starting from the position after the first
-  // space
-  size_t nextSpacePos = resultString.find(' ', spacePos + 1);
+// Function to split the input lines into frames of up to batch_size lines
+// that the server takes, none larger than max_frame_size. Returns the first
+// line of every frame followed by the number of lines
+std::vector<size_t> frameStarts(const std::vector<std::string> &inputs,
+                                size_t batch_size) {
+  std::vector<size_t> starts;
+  size_t size = 0;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    size_t line_size = 4 + inputs[i].size();
+    if (starts.empty() || i - starts.back() == batch_size ||
+        size + line_size > max_frame_size) {
+      starts.push_back(i);
+      size = header_size;
+    }
+    size += line_size;
+  }
+  starts.push_back(inputs.size());
+  return starts;
+}
 
-  // Extract the second part as an integer
-  int hyperperiod =
-      std::stoi(resultString.substr(spacePos + 1, nextSpacePos - spacePos - 1));
+// Struct to hold arguments for the thread that sends pipelined frames
+struct SenderArguments {
+  Channel *channel;
+  const std::vector<std::string> *inputs;
+  const std::vector<size_t> *starts; // Made by frameStarts()
+};
 
-  // The rest is the remaining string
-  std::string end = resultString.substr(nextSpacePos + 1);
+// Sender thread function, writes the input lines as frames without waiting
+// for the replies
+void *sender_function(void *arguments) {
+  SenderArguments *args = static_cast<SenderArguments *>(arguments);
+  const std::vector<size_t> &starts = *args->starts;
+
+  for (size_t frame_index = 0; frame_index + 1 < starts.size();
+       ++frame_index) {
+    std::string frame = requestFrame(*args->inputs, starts[frame_index],
+                                     starts[frame_index + 1]);
+    if (!writeAll(*args->channel, frame.data(), frame.size())) {
+      std::cerr << "ERROR writing to socket" << std::endl;
+      exit(0);
+    }
+  }
+  if (args->channel->rings.attached()) {
+    ringClose(args->channel->rings.requests);
+  }
+  return nullptr;
+}
 
-  std::stringstream info;
-  outputInfo(info, tasks, iteration, hyperperiod, utility);
-
-  (*output) += info.str();
-
-  if (buffer.find("notSchedulable") != std::string::npos) {
-    (*output) += "Rate Monotonic Algorithm execution for CPU " +
-                 std::to_string(iteration) + ":" +
-                 "\nThe task set is not schedulable";
-  } else if (buffer.find("unknown") != std::string::npos) {
-    (*output) += "Rate Monotonic Algorithm execution for CPU " +
-                 std::to_string(iteration) + ":" +
-                 "\nTask set schedulability is unknown";
-  } else {
-    (*output) += "Rate Monotonic Algorithm execution for CPU " +
-                 std::to_string(iteration) + ":" +
-                 "\nScheduling Diagram for CPU " + std::to_string(iteration) +
-                 ": " + end;
+// Function to send every input line over one connection, pipelining the
+// requests while the replies are read back in order. On this host the
+// connection moves onto shared-memory rings
+void runPersistent(char *serverIP, char *portno,
+                   const std::vector<std::string> &inputs,
+                   std::vector<std::string> &outputs, size_t batch_size) {
+  Channel channel;
+  channel.fd = connectToServer(serverIP, portno);
+  attachRings(channel);
+  std::vector<size_t> starts = frameStarts(inputs, batch_size);
+  SenderArguments sender_args = {&channel, &inputs, &starts};
+  pthread_t sender;
+  pthread_create(&sender, nullptr, sender_function, &sender_args);
+
+  std::vector<Result> results;
+  for (size_t frame_index = 0; frame_index + 1 < starts.size();
+       ++frame_index) {
+    size_t first = starts[frame_index];
+    size_t last = starts[frame_index + 1];
+    readReply(channel, last - first, results);
+    for (size_t i = first; i < last; ++i) {
+      outputs[i] = formatResult(inputs[i], i + 1, results[i - first]);
+    }
   }
 
-  return nullptr;
+  pthread_join(sender, nullptr);
+  close(channel.fd);
+  unmapSharedRings(channel.rings);
 }
 
-// Function to get inputs from user
-std::vector<std::string> get_inputs() {
-  std::vector<std::string> inputs;
-  std::string input;
+// Function to parse one session command and append it to frame. The task
+// of an add is parsed as in a task line. Returns false with error set if the
+// command is malformed, frame is then left as it was
+bool parseSessionCommand(std::string_view input, std::string &frame,
+                         ParseError &error) {
+  size_t position = 0;
+  skipSeparators(input, position);
+  size_t verb_start = position;
+  while (position < input.size() && !isSeparator(input[position])) {
+    ++position;
+  }
+  std::string_view verb = input.substr(verb_start, position - verb_start);
+  std::string command;
+  if (verb == "add") {
+    Task task;
+    if (!nextTask(input, position, task, error)) {
+      if (error.message == nullptr) {
+        error = {position, "missing task"};
+      }
+      return false;
+    }
+    putU8(command, (unsigned char)SessionOp::Add);
+    putU8(command, task.name);
+    putU32(command, task.wcet);
+    putU32(command, task.period);
+  } else if (verb == "remove") {
+    skipSeparators(input, position);
+    if (position == input.size()) {
+      error = {position, "missing task name"};
+      return false;
+    }
+    putU8(command, (unsigned char)SessionOp::Remove);
+    putU8(command, input[position++]);
+    if (position < input.size() && !isSeparator(input[position])) {
+      error = {position, "expected whitespace after task name"};
+      return false;
+    }
+  } else if (verb == "query" || verb == "diagram") {
+    putU8(command, (unsigned char)SessionOp::Query);
+    putU8(command, verb == "diagram");
+  } else {
+    error = {verb_start, verb.empty() ? "missing command" : "unknown command"};
+    return false;
+  }
+  skipSeparators(input, position);
+  if (position < input.size()) {
+    error = {position, "unexpected text after command"};
+    return false;
+  }
+  frame += command;
+  return true;
+}
+
+// Function to run an admission session over one connection. Every input line
+// is a command: "add NAME WCET PERIOD", "remove NAME", "query" or "diagram".
+// The commands go out in one version 2 frame and each result is printed
+// after its command, a malformed command is reported and skipped
+void runSession(char *serverIP, char *portno,
+                const std::vector<std::string> &inputs) {
+  std::string frame;
+  startFrame(frame, session_version, 0);
+  std::vector<std::string> commands;
+  ParseError error;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (!parseSessionCommand(inputs[i], frame, error)) {
+      std::cerr << parseErrorText("session line " + std::to_string(i + 1),
+                                  error);
+      continue;
+    }
+    commands.push_back(inputs[i]);
+  }
+  std::string count;
+  putU32(count, commands.size());
+  frame.replace(sizeof(protocol_magic) + 1, 4, count);
+  if (frame.size() > max_frame_size) {
+    std::cerr << "ERROR too many session commands for one frame" << std::endl;
+    exit(0);
+  }
+
+  Channel channel;
+  channel.fd = connectToServer(serverIP, portno);
+  uint32_t reply_count;
+  if (!writeAll(channel, frame.data(), frame.size())) {
+    std::cerr << "ERROR writing to socket" << std::endl;
+    exit(0);
+  }
+  if (!readHeader(channel, session_version, reply_count) ||
+      reply_count != commands.size()) {
+    std::cerr << "ERROR reading from socket" << std::endl;
+    exit(0);
+  }
 
-  while (std::getline(std::cin, input)) {
-    if (!input.empty()) {
-      inputs.push_back(input);
+  for (const auto &command : commands) {
+    unsigned char status;
+    uint64_t utilization_bits, hyperperiod;
+    uint32_t tasks, runs;
+    double utilization;
+    if (!readAll(channel, (char *)&status, 1) ||
+        !readU64(channel, utilization_bits) || !readU64(channel, hyperperiod) ||
+        !readU32(channel, tasks) || !readU32(channel, runs) ||
+        sessionStatusName(status) == nullptr) {
+      std::cerr << "ERROR reading from socket" << std::endl;
+      exit(0);
+    }
+    memcpy(&utilization, &utilization_bits, sizeof(double));
+    std::cout << command << ": " << sessionStatusName(status) << " ("
+              << tasks << " tasks, utilization " << std::setprecision(2)
+              << std::fixed << utilization << ", hyperperiod ";
+    if (hyperperiod == 0) {
+      std::cout << "too large";
+    } else {
+      std::cout << hyperperiod;
     }
+    std::cout << ")";
+    for (uint32_t i = 0; i < runs; ++i) {
+      DiagramRun run;
+      if (!readAll(channel, &run.name, 1) || !readU32(channel, run.length)) {
+        std::cerr << "ERROR reading from socket" << std::endl;
+        exit(0);
+      }
+      std::cout << (i == 0 ? "\nScheduling Diagram: " : ", ");
+      if (run.name == 'I') {
+        std::cout << "Idle";
+      } else {
+        std::cout << run.name;
+      }
+      std::cout << "(" << run.length << ")";
+    }
+    std::cout << "\n";
   }
-  return inputs;
+  close(channel.fd);
 }
 
 int main(int argc, char *argv[]) {
-  const std::vector<std::string> inputs = get_inputs();
+  const std::vector<std::string> inputs = readInputs();
   std::vector<std::string> outputs(inputs.size());
   std::vector<pthread_t> threads(inputs.size());
   std::vector<Arguments> arg_objects;
-
-  if (argc != 3) {
-    std::cerr << "usage " << argv[0] << " hostname port" << std::endl;
+  bool persistent = false;
+  bool session = false;
+  size_t batch_size = 1;
+
+  if (argc < 3) {
+    std::cerr << "usage " << argv[0]
+              << " hostname port [--persistent] [--batch lines] [--session] "
+                 "[--tcp]"
+              << std::endl;
     exit(0);
   }
+  for (int i = 3; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--persistent") {
+      persistent = true;
+    } else if (arg == "--batch" && i + 1 < argc) {
+      persistent = true;
+      batch_size = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--session") {
+      session = true;
+    } else if (arg == "--tcp") {
+      force_tcp = true;
+    }
+  }
 
-  // Prepare arguments
-  for (size_t i = 0; i < inputs.size(); ++i) {
-    arg_objects.emplace_back(inputs[i], &outputs[i], i + 1, argv[1], argv[2]);
-    // std:: cout << inputs[i] <<  &outputs[i] <<  i + 1 << " " << argv[1] << "
-    // " <<  argv[2]<<  std::endl;
+  if (session) {
+    runSession(argv[1], argv[2], inputs);
+    return 0;
   }
-  // Create threads
   for (size_t i = 0; i < inputs.size(); ++i) {
-    pthread_create(&threads[i], nullptr, thread_function, &arg_objects[i]);
+    if (inputs[i].size() > max_task_set_size) {
+      std::cerr << "ERROR task set for CPU " << i + 1
+                << " is larger than the server takes" << std::endl;
+      exit(0);
+    }
   }
-  // Wait for threads to finish
-  for (size_t i = 0; i < inputs.size(); ++i) {
-    pthread_join(threads[i], nullptr);
+
+  if (persistent) {
+    runPersistent(argv[1], argv[2], inputs, outputs, batch_size);
+  } else {
+    // Prepare arguments
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      arg_objects.emplace_back(inputs[i], &outputs[i], i + 1, argv[1],
+                               argv[2]);
+    }
+    // Create threads
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      pthread_create(&threads[i], nullptr, thread_function, &arg_objects[i]);
+    }
+    // Wait for threads to finish
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      pthread_join(threads[i], nullptr);
+    }
   }
 
   // Print outputs
@@ -0,0 +1,144 @@
+// Wire protocol spoken between HW2Client and HW2Server. Header only, like
+// SharedRing.h
+//
+// Every frame starts with the bytes 'R' 'M' 'S' and the protocol version,
+// then a big-endian uint32 count. A request carries count task sets, each a
+// uint32 length and the text. A reply carries count results, each a status
+// byte, the utilization as IEEE 754 bits in a uint64, the hyperperiod as a
+// uint64 and a uint32 interval count followed by a name byte and a uint32
+// length per interval. A connection stays open for further frames until the
+// client closes it.
+//
+// Frames with version 2 drive the admission session of their connection
+// instead. A request carries count commands, each an opcode byte followed by
+// the name byte, uint32 WCET and uint32 period of a task to add, the name
+// byte of a task to remove, or a flags byte for a query where bit 0 asks for
+// the diagram. A reply carries count results, each a SessionStatus byte, the
+// session utilization as IEEE 754 bits in a uint64, its hyperperiod as a
+// uint64, its task count as a uint32 and the diagram encoded as in version 1
+//
+// A version 3 frame, only accepted over the AF_UNIX socket from a client of
+// the same user, carries one uint32 length and the name of a shared memory
+// object made by createSharedRings(). Its reply carries one status byte, 0
+// once the rings are attached. Every later frame of the connection and its
+// reply then goes through the rings instead of the socket
+//
+// A version 4 frame is a version 1 request whose reply carries each diagram
+// compact instead: the uint32 interval count, a uint32 byte count and the
+// bytes of CompactDiagram as they are, a few bytes per interval rather than
+// five and repeating blocks of intervals sent once
+#ifndef HW2_PROTOCOL_H
+#define HW2_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+const char protocol_magic[3] = {'R', 'M', 'S'};
+const unsigned char protocol_version = 1;
+const unsigned char session_version = 2;
+const unsigned char ring_version = 3;
+const unsigned char compact_version = 4;
+const size_t header_size = sizeof(protocol_magic) + 1 + 4;
+
+// Largest request frame and task set a server takes, a frame declaring more
+// is malformed so a client cannot make the server buffer without limit
+const size_t max_frame_size = 1 << 26;
+const size_t max_task_set_size = 1 << 20;
+
+// Status of the analysis of one task set
+enum class ResultStatus : unsigned char {
+  Schedulable,
+  NotSchedulable,
+  Unknown,
+  HyperperiodTooLarge
+};
+
+// Commands of a version 2 frame
+enum class SessionOp : unsigned char { Add, Remove, Query };
+
+// Outcome of a session command
+enum class SessionStatus : unsigned char {
+  Admitted,           // The task was added and every deadline is still met
+  Rejected,           // Adding the task would miss a deadline, nothing changed
+  Invalid,            // Zero period or a name already in the session
+  Removed,
+  NotFound,
+  Schedulable,        // Answer to a query
+  HyperperiodTooLarge // Answer to a query for a diagram, needs a window
+};
+
+// Function to describe a session status byte, nullptr if it is unknown
+inline const char *sessionStatusName(unsigned char status) {
+  switch ((SessionStatus)status) {
+  case SessionStatus::Admitted:
+    return "admitted";
+  case SessionStatus::Rejected:
+    return "rejected";
+  case SessionStatus::Invalid:
+    return "invalid";
+  case SessionStatus::Removed:
+    return "removed";
+  case SessionStatus::NotFound:
+    return "not found";
+  case SessionStatus::Schedulable:
+    return "schedulable";
+  case SessionStatus::HyperperiodTooLarge:
+    return "hyperperiod too large, use --window";
+  }
+  return nullptr;
+}
+
+// Function to get the size of a session command from its opcode, 0 if the
+// opcode is unknown
+inline size_t commandSize(unsigned char opcode) {
+  switch ((SessionOp)opcode) {
+  case SessionOp::Add:
+    return 10;
+  case SessionOp::Remove:
+  case SessionOp::Query:
+    return 2;
+  }
+  return 0;
+}
+
+// Functions to append big-endian integers to a frame
+inline void putU8(std::string &frame, unsigned char value) {
+  frame += (char)value;
+}
+
+inline void putU32(std::string &frame, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    frame += (char)(value >> shift);
+  }
+}
+
+inline void putU64(std::string &frame, uint64_t value) {
+  putU32(frame, value >> 32);
+  putU32(frame, value);
+}
+
+// Function to read a big-endian uint32
+inline uint32_t getU32(const char *data) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+         (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+// Function to start a frame of a version carrying count task sets, commands
+// or results
+inline void startFrame(std::string &frame, unsigned char version,
+                       uint32_t count) {
+  frame.assign(protocol_magic, sizeof(protocol_magic));
+  putU8(frame, version);
+  putU32(frame, count);
+}
+
+// Function to check the magic and version of a frame header
+inline bool frameHeaderIs(const char *header, unsigned char version) {
+  return header[0] == protocol_magic[0] && header[1] == protocol_magic[1] &&
+         header[2] == protocol_magic[2] &&
+         (unsigned char)header[sizeof(protocol_magic)] == version;
+}
+
+#endif
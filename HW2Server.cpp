@@ -1,66 +1,77 @@
 // Write your code here
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sstream>
 #include <string>
 #include <strings.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
-// Struct to hold task information
-struct Task {
-  char name;
-  unsigned wcet;
-  unsigned period;
-  unsigned initial_wcet; // We need to store initial WCET for reset
-};
+#include "HW2Protocol.h"
+#include "RMEngine.h"
+#include "SharedRing.h"
+
+// Options of the analysis, of which the server takes --per-tick,
+// --liu-layland, --window and --no-diagram
+AnalysisOptions options;
 
-// Struct to hold task interval information
-struct TaskInterval {
-  char name;
-  unsigned start;
-  unsigned end;
-  bool stopped; // Represents if the task was interrupted
+// Struct to hold the result of the analysis of one task set, the diagram is
+// left in the compact diagram of the workspace it was computed on
+struct Result {
+  ResultStatus status;
+  double utilization;
+  unsigned long long hyperperiod; // 0 if it is too large to simulate
 };
 
-// Function to calculate the greatest common divisor (GCD) using Euclidean
-// algorithm
-unsigned long long gcd(unsigned long long a, unsigned long long b) {
-  while (b != 0) {
-    unsigned long long temp = b;
-    b = a % b;
-    a = temp;
+// Function to get the status sent for a verdict
+ResultStatus resultStatus(Verdict verdict) {
+  switch (verdict) {
+  case Verdict::Schedulable:
+    return ResultStatus::Schedulable;
+  case Verdict::NotSchedulable:
+    return ResultStatus::NotSchedulable;
+  case Verdict::Unknown:
+    return ResultStatus::Unknown;
+  case Verdict::HyperperiodTooLarge:
+    return ResultStatus::HyperperiodTooLarge;
   }
-  return a;
-}
-
-// Function to calculate the least common multiple (LCM) using GCD
-unsigned long long lcm(unsigned long long a, unsigned long long b) {
-  return (a * b) / gcd(a, b);
+  return ResultStatus::Unknown;
 }
 
-// Function to compare tasks based on their periods
-bool compareTasks(const Task &a, const Task &b) { return a.period < b.period; }
+Result calculations(const std::string &input, Workspace &workspace) {
 
-std::string calculations(const std::string &input) {
+  std::vector<Task> &tasks = workspace.tasks;
+  Result result;
 
-  std::stringstream input_string(input);
-  std::stringstream returnString;
-  std::vector<Task> tasks;
-  char task_name;
-  unsigned task_wcet;
-  unsigned task_period;
-
-  // Parse input string
-  while (input_string >> task_name >> task_wcet >> task_period) {
-    tasks.push_back({task_name, task_wcet, task_period, task_wcet});
-  }
+  // Parse input string, a malformed line is analyzed up to the error. The
+  // client parses the same line and reports the error to the user
+  tasks.clear();
+  workspace.diagram.clear();
+  ParseError error;
+  parseTasks(input, tasks, error);
 
   // Calculate utilization
   double utilization = 0.0;
@@ -69,126 +80,1452 @@ std::string calculations(const std::string &input) {
   }
 
   // Calculate hyperperiod
-  unsigned hyperperiod = 1;
+  unsigned long long hyperperiod = 1;
   for (const auto &task : tasks) {
     hyperperiod = lcm(hyperperiod, task.period);
   }
 
-  // Format utilization with precision 2
-  returnString << std::fixed << std::setprecision(2) << utilization << " ";
-  returnString << std::to_string(hyperperiod) + " ";
+  result.utilization = utilization;
+  result.hyperperiod = hyperperiod > max_hyperperiod ? 0 : hyperperiod;
 
   // Sort tasks based on their periods
-  std::sort(tasks.begin(), tasks.end(), compareTasks);
-
-  // Check schedulability
-  double threshold = tasks.size() * (std::pow(2.0, 1.0 / tasks.size()) - 1);
-
-  if (utilization > 1) {
-    returnString << "notSchedulable"; // case where util is > 1
-    return returnString.str();
-  } else if (utilization > threshold || utilization < 0) {
-    returnString << "unknown"; // case 2
-    return returnString.str();
-  }
-
-  else {
-    // Generate scheduling diagram
-    std::vector<TaskInterval> task_intervals;
-    for (unsigned tick = 0; tick < hyperperiod; ++tick) {
-      bool task_running = false;
-      for (auto &task : tasks) {
-        if (tick % task.period == 0) {
-          task.wcet = task.initial_wcet; // Reset WCET
-          for (auto &interval : task_intervals) {
-            // if (interval.name == task.name) {
-            interval.stopped = true; // Reset stopped flag
-                                     //}
-          }
-        }
+  sortByPriority(tasks);
+
+  // Check schedulability and generate the scheduling diagram, limited to the
+  // simulation window
+  Verdict verdict =
+      decide(tasks, hyperperiod, options, workspace.response_times);
+  result.status = resultStatus(verdict);
+  if (verdict == Verdict::Schedulable && !options.skip_diagram) {
+    simulateWindow(tasks, hyperperiod, options, workspace);
+  }
+  return result;
+}
+
+void fireman(int) {
+  while (waitpid(-1, NULL, WNOHANG) > 0)
+    ;
+}
+
+// Path of the AF_UNIX socket and the pre-forked workers, removed and stopped
+// by the server process when it is stopped
+std::string unix_path;
+std::vector<pid_t> worker_pids;
+pid_t server_pid;
+
+void stopServer(int) {
+  if (getpid() == server_pid) {
+    if (!unix_path.empty()) {
+      unlink(unix_path.c_str());
+    }
+    for (pid_t pid : worker_pids) {
+      if (pid > 0) {
+        kill(pid, SIGTERM);
       }
-      for (auto &task : tasks) {
-        if (task.wcet > 0) {
-          task_running = true;
-          if (task.wcet == task.initial_wcet) {
-            // Fresh task, create new interval
-            task_intervals.push_back({task.name, tick, tick + 1, false});
-          } else {
-            // Task still running, extend interval or create new one
-            bool found = false;
-            for (auto &interval : task_intervals) {
-              if (interval.name == task.name && !interval.stopped) {
-                interval.end = tick + 1; // Extend interval
-                found = true;
-                break;
-              }
-            }
-            if (!found) {
-              task_intervals.push_back({task.name, tick, tick + 1, false});
-            }
-          }
-          --task.wcet;
-          break; // Move to next tick
-        }
+    }
+  }
+  _exit(0);
+}
+
+// Server metrics live in an anonymous shared mapping like the result cache,
+// so forked children and compute threads all add to the same counters. Every
+// update is a relaxed atomic add
+enum class Stage { Accept, Read, Parse, Simulate, Format, Write };
+const size_t stage_count = 6;
+const char *const stage_names[stage_count] = {"accept",   "read",   "parse",
+                                              "simulate", "format", "write"};
+
+enum class ErrorCause { Accept, Fork, Read, Write, Malformed };
+const size_t error_count = 5;
+const char *const error_names[error_count] = {"accept", "fork", "read",
+                                              "write", "malformed"};
+
+// Bucket i of a latency histogram counts durations below 2^i microseconds,
+// the last bucket counts everything slower
+const size_t histogram_buckets = 24;
+
+struct Histogram {
+  uint64_t buckets[histogram_buckets];
+  uint64_t count;
+  uint64_t total_ns;
+};
+
+struct ServerMetrics {
+  uint64_t connections;
+  uint64_t requests; // Frames answered
+  uint64_t task_sets;
+  uint64_t session_commands;
+  uint64_t in_flight; // Frames being answered right now
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t shared_rings; // Connections moved onto shared-memory rings
+  uint64_t errors[error_count];
+  Histogram stages[stage_count];
+};
+
+// Process-local until main() maps the shared copy
+ServerMetrics local_metrics;
+ServerMetrics *metrics = &local_metrics;
+
+// Function to map the shared metrics
+bool createMetrics() {
+  void *memory = mmap(nullptr, sizeof(ServerMetrics), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+  metrics = (ServerMetrics *)memory;
+  return true;
+}
+
+// Function to add to a shared counter
+void addCount(uint64_t &counter, uint64_t amount = 1) {
+  __atomic_fetch_add(&counter, amount, __ATOMIC_RELAXED);
+}
+
+void countError(ErrorCause cause) { addCount(metrics->errors[(size_t)cause]); }
+
+// Function to read the monotonic clock in nanoseconds
+uint64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Function to record that a stage took from start to end
+void recordStage(Stage stage, uint64_t start, uint64_t end) {
+  Histogram &histogram = metrics->stages[(size_t)stage];
+  uint64_t nanoseconds = end > start ? end - start : 0;
+  uint64_t microseconds = nanoseconds / 1000;
+  size_t bucket = microseconds == 0 ? 0 : 64 - __builtin_clzll(microseconds);
+  addCount(histogram.buckets[std::min(bucket, histogram_buckets - 1)]);
+  addCount(histogram.count);
+  addCount(histogram.total_ns, nanoseconds);
+}
+
+// Function to write a whole buffer, retrying on short writes
+bool writeAll(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n <= 0) {
+      return false;
+    }
+    addCount(metrics->bytes_out, n);
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Struct to hold how far the oldest frame of a connection has been checked,
+// so a frame arriving over many reads is not checked again from its start
+struct FrameCheck {
+  size_t offset = 0;    // First entry not checked yet, 0 before the header
+  uint32_t entries = 0; // Task sets or commands checked
+};
+
+// Function to check for one complete request frame at the front of buffer
+// and store the offset and length of its task sets, or of its commands for a
+// session frame, in lines if given. Returns the frame size, or 0 if more
+// bytes are needed or the frame is malformed. A frame is malformed as soon as
+// its fields show it is larger than max_frame_size, so a buffer holding that
+// many bytes always holds a complete frame or a malformed one. Given a check
+// instead of lines, the check goes on where the last one stopped
+size_t parseFrame(const std::string &buffer,
+                  std::vector<std::pair<size_t, size_t>> *lines,
+                  bool &malformed, FrameCheck *check = nullptr) {
+  if (lines != nullptr) {
+    lines->clear();
+  }
+  malformed = false;
+  size_t checked = std::min(buffer.size(), sizeof(protocol_magic));
+  if (buffer.compare(0, checked, protocol_magic, checked) != 0) {
+    malformed = true;
+    return 0;
+  }
+  if (buffer.size() <= sizeof(protocol_magic)) {
+    return 0;
+  }
+  unsigned char version = buffer[sizeof(protocol_magic)];
+  if (version != protocol_version && version != session_version &&
+      version != ring_version && version != compact_version) {
+    malformed = true;
+    return 0;
+  }
+  if (buffer.size() < header_size) {
+    return 0;
+  }
+
+  uint32_t count = getU32(buffer.data() + header_size - 4);
+  size_t offset = header_size;
+  uint32_t i = 0;
+  if (check != nullptr && check->offset > 0) {
+    offset = check->offset;
+    i = check->entries;
+  }
+  auto incomplete = [&]() -> size_t {
+    if (check != nullptr) {
+      check->offset = offset;
+      check->entries = i;
+    }
+    return 0;
+  };
+  // The smallest command, or the length of a task set
+  size_t smallest = version == session_version ? 2 : 4;
+  for (; i < count; ++i) {
+    if (offset + smallest > max_frame_size) {
+      malformed = true;
+      return 0;
+    }
+    size_t start, size;
+    if (version == session_version) {
+      if (buffer.size() <= offset) {
+        return incomplete();
+      }
+      start = offset;
+      size = commandSize(buffer[offset]);
+      if (size == 0) {
+        malformed = true;
+        return 0;
+      }
+    } else {
+      if (buffer.size() < offset + 4) {
+        return incomplete();
       }
-      if (!task_running) {
-        // No task is running at this time, insert idle interval
-        task_intervals.push_back({'I', tick, tick + 1, false});
+      start = offset + 4;
+      size = getU32(buffer.data() + offset);
+    }
+    if (size > max_task_set_size || start + size > max_frame_size) {
+      malformed = true;
+      return 0;
+    }
+    if (buffer.size() - start < size) {
+      return incomplete();
+    }
+    if (lines != nullptr) {
+      lines->emplace_back(start, size);
+    }
+    offset = start + size;
+  }
+  if (check != nullptr) {
+    *check = FrameCheck();
+  }
+  return offset;
+}
+
+// Function to append a diagram to a reply frame as its run count and one
+// name and length per run, expanded from the compact form
+void encodeDiagram(std::string &frame, const CompactDiagram &diagram) {
+  putU32(frame, diagram.runs);
+  forEachRun(diagram, [&](const DiagramRun &run) {
+    putU8(frame, run.name);
+    putU32(frame, run.length);
+  });
+}
+
+// Size of a result before its diagram: the status, utilization and
+// hyperperiod
+const size_t result_header_size = 1 + 8 + 8;
+
+// Function to append one result to a reply frame with its diagram compact,
+// as in a version 4 frame
+void encodeResult(std::string &frame, const Result &result,
+                  const CompactDiagram &diagram) {
+  uint64_t utilization_bits;
+  memcpy(&utilization_bits, &result.utilization, sizeof(double));
+  putU8(frame, (unsigned char)result.status);
+  putU64(frame, utilization_bits);
+  putU64(frame, result.hyperperiod);
+  putU32(frame, diagram.runs);
+  putU32(frame, diagram.bytes.size());
+  frame += diagram.bytes;
+}
+
+// Function to append a result made by encodeResult() to a reply frame of a
+// version, expanding its diagram unless the frame is a version 4 one
+void appendResult(std::string &frame, const std::string &result,
+                  unsigned char version) {
+  if (version == compact_version) {
+    frame += result;
+    return;
+  }
+  const size_t diagram_start = result_header_size + 8;
+  frame.append(result, 0, result_header_size);
+  putU32(frame, getU32(result.data() + result_header_size));
+  forEachRun(result.data() + diagram_start, result.size() - diagram_start,
+             [&](const DiagramRun &run) {
+               putU8(frame, run.name);
+               putU32(frame, run.length);
+             });
+}
+
+// Per-worker buffers reused from one frame to the next, so answering a frame
+// allocates nothing once they have grown to fit the largest frame seen. The
+// reply frame is built in workspace.output
+struct FrameScratch {
+  Workspace workspace;
+  std::vector<std::pair<size_t, size_t>> lines; // Offset and length
+  std::string line;
+  std::string key;
+  std::string result; // Encoded by encodeResult()
+};
+
+// Encoded results are cached by canonical task set in an anonymous shared
+// mapping created before the first fork, so forked children and compute
+// threads all see the same entries. Results are kept as encodeResult() makes
+// them, with the diagram compact, in a slab of chunks shared by all entries,
+// each result in a chain of as many chunks as it needs. Keys longer than
+// cache_key_size and results taking more than a quarter of the slab are
+// computed without being cached
+const size_t cache_key_size = 512;
+const size_t cache_chunk_size = 256;
+const size_t cache_chunks_per_entry = 32; // Slab size for each entry
+
+// Index standing for no entry at the end of a chain or list
+const uint32_t no_entry = UINT32_MAX;
+
+// How long a lookup waits for a computation before checking that the
+// process computing it is still alive
+const long cache_wait_ns = 100000000;
+
+enum class CacheState : unsigned char { Empty, Computing, Ready };
+
+// Entries are linked by index, since the mapping holds no pointers. An entry
+// with a key is chained from the bucket of its hash, a ready entry is also
+// in the list from the most to the least recently used one and an empty one
+// reused after eviction is in the free list, so lookups and evictions take a
+// few steps instead of a scan of every entry
+struct CacheEntry {
+  CacheState state;
+  uint64_t hash;
+  uint32_t next;  // Next entry in the bucket, or in the free list
+  uint32_t newer; // Neighbours in the recently used list
+  uint32_t older;
+  uint32_t key_length;
+  uint32_t value_length;
+  uint32_t first_chunk; // Chain of the chunks holding the result
+  pid_t owner;          // Process computing the result
+  uint64_t ticket;      // Claim of that computation
+  char key[cache_key_size];
+};
+
+struct CacheChunk {
+  uint32_t next; // Next chunk of the result, or in the free list
+  char data[cache_chunk_size - sizeof(uint32_t)];
+};
+
+struct ResultCache {
+  pthread_mutex_t mutex; // Process-shared and robust
+  pthread_cond_t done;   // Broadcast whenever a computation finishes
+  uint64_t tickets;      // Claims handed out so far
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t coalesced; // Lookups that waited for an identical computation
+  uint64_t evictions;
+  size_t capacity;
+  size_t bucket_count;   // A power of two
+  uint32_t unused;       // Entries from here on were never used
+  uint32_t free_entries; // Head of the free list
+  uint32_t newest;       // Ends of the recently used list
+  uint32_t oldest;
+  size_t chunk_count;
+  uint32_t unused_chunks; // Chunks from here on were never used
+  uint32_t free_chunks;   // Head of the free list of chunks
+  size_t free_chunk_count;
+  CacheEntry *entries;
+  uint32_t *buckets;
+  CacheChunk *chunks;
+};
+
+ResultCache *result_cache = nullptr;
+
+// Function to map the shared cache with room for capacity entries
+bool createCache(size_t capacity) {
+  if (capacity >= no_entry / cache_chunks_per_entry) {
+    return false;
+  }
+  size_t bucket_count = 1;
+  while (bucket_count < capacity) {
+    bucket_count *= 2;
+  }
+  size_t chunk_count = capacity * cache_chunks_per_entry;
+  size_t size = sizeof(ResultCache) + capacity * sizeof(CacheEntry) +
+                bucket_count * sizeof(uint32_t) +
+                chunk_count * sizeof(CacheChunk);
+  void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+  // The mapping is zero filled, and entries and chunks are only touched once
+  // taken from the unused ones
+  result_cache = (ResultCache *)memory;
+  result_cache->capacity = capacity;
+  result_cache->bucket_count = bucket_count;
+  result_cache->free_entries = no_entry;
+  result_cache->newest = no_entry;
+  result_cache->oldest = no_entry;
+  result_cache->entries = (CacheEntry *)(result_cache + 1);
+  result_cache->buckets = (uint32_t *)(result_cache->entries + capacity);
+  std::fill_n(result_cache->buckets, bucket_count, no_entry);
+  result_cache->chunk_count = chunk_count;
+  result_cache->free_chunks = no_entry;
+  result_cache->chunks = (CacheChunk *)(result_cache->buckets + bucket_count);
+
+  pthread_mutexattr_t mutex_attr;
+  pthread_mutexattr_init(&mutex_attr);
+  pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&result_cache->mutex, &mutex_attr);
+  pthread_mutexattr_destroy(&mutex_attr);
+
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&result_cache->done, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+  return true;
+}
+
+// Function to rewrite a task set in priority order, so inputs listing the
+// same tasks in a different order share one key. Tasks with equal periods
+// keep their input order since it decides their priority. The utilization
+// is summed in input order, as calculations() would, so the value sent does
+// not depend on which input filled the cache. The status is decided from the
+// tasks in priority order alone, so it is the same for every such input
+void canonicalKey(const std::string &input, Workspace &workspace,
+                  std::string &key, double &utilization) {
+  std::vector<Task> &tasks = workspace.tasks;
+  tasks.clear();
+  ParseError error;
+  parseTasks(input, tasks, error);
+  utilization = 0.0;
+  for (const auto &task : tasks) {
+    utilization += static_cast<double>(task.wcet) / task.period;
+  }
+  sortByPriority(tasks);
+
+  key.clear();
+  for (const auto &task : tasks) {
+    if (!key.empty()) {
+      key += ' ';
+    }
+    key += task.name;
+    key += ' ';
+    appendNumber(key, task.wcet);
+    key += ' ';
+    appendNumber(key, task.period);
+  }
+}
+
+// FNV-1a hash of a cache key
+uint64_t hashKey(const std::string &key) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : key) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// The functions below keep the chains and lists of the cache, whose mutex
+// must be held
+
+// Function to get the chain of entries whose hash falls in its bucket
+uint32_t &cacheBucket(uint64_t hash) {
+  return result_cache->buckets[hash & (result_cache->bucket_count - 1)];
+}
+
+uint32_t entryIndex(const CacheEntry &entry) {
+  return &entry - result_cache->entries;
+}
+
+// Function to find the entry holding key
+CacheEntry *findEntry(uint64_t hash, const std::string &key) {
+  for (uint32_t i = cacheBucket(hash); i != no_entry;
+       i = result_cache->entries[i].next) {
+    CacheEntry &entry = result_cache->entries[i];
+    if (entry.hash == hash && entry.key_length == key.size() &&
+        memcmp(entry.key, key.data(), key.size()) == 0) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+// Function to chain an entry holding a key from its bucket
+void linkBucket(CacheEntry &entry) {
+  uint32_t &head = cacheBucket(entry.hash);
+  entry.next = head;
+  head = entryIndex(entry);
+}
+
+void unlinkBucket(CacheEntry &entry) {
+  uint32_t *link = &cacheBucket(entry.hash);
+  while (*link != entryIndex(entry)) {
+    link = &result_cache->entries[*link].next;
+  }
+  *link = entry.next;
+}
+
+// Function to put a ready entry at the front of the recently used list
+void linkNewest(CacheEntry &entry) {
+  ResultCache &cache = *result_cache;
+  entry.newer = no_entry;
+  entry.older = cache.newest;
+  if (cache.newest != no_entry) {
+    cache.entries[cache.newest].newer = entryIndex(entry);
+  } else {
+    cache.oldest = entryIndex(entry);
+  }
+  cache.newest = entryIndex(entry);
+}
+
+void unlinkRecent(CacheEntry &entry) {
+  ResultCache &cache = *result_cache;
+  (entry.newer != no_entry ? cache.entries[entry.newer].older
+                           : cache.newest) = entry.older;
+  (entry.older != no_entry ? cache.entries[entry.older].newer
+                           : cache.oldest) = entry.newer;
+}
+
+// Function to empty an entry whose result was not kept
+void freeEntry(CacheEntry &entry) {
+  unlinkBucket(entry);
+  entry.state = CacheState::Empty;
+  entry.next = result_cache->free_entries;
+  result_cache->free_entries = entryIndex(entry);
+}
+
+// Function to give the chunks of a result back to the slab
+void releaseChunks(CacheEntry &entry) {
+  ResultCache &cache = *result_cache;
+  uint32_t i = entry.first_chunk;
+  while (i != no_entry) {
+    uint32_t next = cache.chunks[i].next;
+    cache.chunks[i].next = cache.free_chunks;
+    cache.free_chunks = i;
+    cache.free_chunk_count++;
+    i = next;
+  }
+  entry.first_chunk = no_entry;
+}
+
+// Function to drop the result of the least recently used ready entry, which
+// is left in its bucket
+CacheEntry &evictOldest() {
+  CacheEntry &entry = result_cache->entries[result_cache->oldest];
+  unlinkRecent(entry);
+  releaseChunks(entry);
+  result_cache->evictions++;
+  return entry;
+}
+
+// Function to take an empty entry, or else to evict the least recently used
+// ready one. Returns nullptr if every entry is being computed
+CacheEntry *victimEntry() {
+  ResultCache &cache = *result_cache;
+  CacheEntry *entry;
+  if (cache.free_entries != no_entry) {
+    entry = &cache.entries[cache.free_entries];
+    cache.free_entries = entry->next;
+  } else if (cache.unused < cache.capacity) {
+    entry = &cache.entries[cache.unused++];
+  } else if (cache.oldest != no_entry) {
+    entry = &evictOldest();
+    unlinkBucket(*entry);
+  } else {
+    return nullptr;
+  }
+  entry->first_chunk = no_entry;
+  return entry;
+}
+
+size_t availableChunks() {
+  return result_cache->free_chunk_count +
+         (result_cache->chunk_count - result_cache->unused_chunks);
+}
+
+// Function to keep a computed result in the slab for its entry, evicting the
+// least recently used results until there is room. Returns false if the
+// result is too large to keep
+bool storeResult(CacheEntry &entry, const std::string &result) {
+  ResultCache &cache = *result_cache;
+  const size_t payload = sizeof(CacheChunk::data);
+  size_t needed = std::max<size_t>(1, (result.size() + payload - 1) / payload);
+  if (needed > cache.chunk_count / 4) {
+    return false;
+  }
+  while (availableChunks() < needed && cache.oldest != no_entry) {
+    freeEntry(evictOldest());
+  }
+  if (availableChunks() < needed) {
+    return false;
+  }
+  uint32_t *link = &entry.first_chunk;
+  for (size_t offset = 0; needed > 0; offset += payload, --needed) {
+    uint32_t i;
+    if (cache.free_chunks != no_entry) {
+      i = cache.free_chunks;
+      cache.free_chunks = cache.chunks[i].next;
+      cache.free_chunk_count--;
+    } else {
+      i = cache.unused_chunks++;
+    }
+    *link = i;
+    link = &cache.chunks[i].next;
+    memcpy(cache.chunks[i].data, result.data() + offset,
+           std::min(payload, result.size() - offset));
+  }
+  *link = no_entry;
+  entry.value_length = result.size();
+  return true;
+}
+
+// Function to empty the whole cache, keeping its counters. Computations under
+// way find their claim gone and do not keep their result
+void resetCache() {
+  ResultCache &cache = *result_cache;
+  for (uint32_t i = 0; i < cache.unused; ++i) {
+    cache.entries[i].state = CacheState::Empty;
+  }
+  std::fill_n(cache.buckets, cache.bucket_count, no_entry);
+  cache.unused = 0;
+  cache.free_entries = no_entry;
+  cache.newest = no_entry;
+  cache.oldest = no_entry;
+  cache.unused_chunks = 0;
+  cache.free_chunks = no_entry;
+  cache.free_chunk_count = 0;
+}
+
+// Function to take the cache mutex back from a process that died holding
+// it, which may have left the chains and lists half updated. The cache is
+// emptied then, and lookups waiting for a computation look again
+void recoverCache(int locked) {
+  if (locked == EOWNERDEAD) {
+    std::cerr << "Result cache lock owner died, emptying the cache"
+              << std::endl;
+    resetCache();
+    pthread_mutex_consistent(&result_cache->mutex);
+    pthread_cond_broadcast(&result_cache->done);
+  }
+}
+
+void lockCache() { recoverCache(pthread_mutex_lock(&result_cache->mutex)); }
+
+// Function to wait a while for a computation to finish, the cache mutex
+// must be held
+void waitCache() {
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_nsec += cache_wait_ns;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000;
+  }
+  recoverCache(pthread_cond_timedwait(&result_cache->done,
+                                      &result_cache->mutex, &deadline));
+}
+
+// Function to check that a process computing an entry is still there
+bool ownerAlive(pid_t owner) {
+  return kill(owner, 0) == 0 || errno != ESRCH;
+}
+
+// Function to copy the result of a ready entry out of the slab
+void loadResult(const CacheEntry &entry, std::string &result) {
+  const size_t payload = sizeof(CacheChunk::data);
+  result.resize(entry.value_length);
+  size_t offset = 0;
+  for (uint32_t i = entry.first_chunk; i != no_entry;
+       i = result_cache->chunks[i].next) {
+    size_t n = std::min(payload, result.size() - offset);
+    memcpy(&result[offset], result_cache->chunks[i].data, n);
+    offset += n;
+  }
+}
+
+// Function to overwrite the utilization of the result encoded at offset
+void patchUtilization(std::string &frame, size_t offset, double utilization) {
+  uint64_t utilization_bits;
+  memcpy(&utilization_bits, &utilization, sizeof(double));
+  for (int i = 0; i < 8; ++i) {
+    frame[offset + 1 + i] = (char)(utilization_bits >> (56 - 8 * i));
+  }
+}
+
+// Function to simulate a task set and encode its result into encoded
+void computeResult(const std::string &input, Workspace &workspace,
+                   std::string &encoded) {
+  uint64_t simulating = nowNs();
+  Result result = calculations(input, workspace);
+  uint64_t formatting = nowNs();
+  encoded.clear();
+  encodeResult(encoded, result, workspace.diagram);
+  recordStage(Stage::Simulate, simulating, formatting);
+  recordStage(Stage::Format, formatting, nowNs());
+}
+
+// Function to append the result for a task set to a reply frame of a
+// version from the cache, computing it on a miss. A lookup for a key that is
+// already being computed waits for that computation instead of starting its
+// own
+void cachedResult(const std::string &input, FrameScratch &scratch,
+                  std::string &frame, unsigned char version) {
+  double utilization;
+  std::string &key = scratch.key;
+  std::string &result = scratch.result;
+  canonicalKey(input, scratch.workspace, key, utilization);
+  size_t offset = frame.size();
+  if (result_cache == nullptr || key.size() > cache_key_size) {
+    computeResult(input, scratch.workspace, result);
+    appendResult(frame, result, version);
+    return;
+  }
+  uint64_t hash = hashKey(key);
+
+  lockCache();
+  bool waited = false;
+  CacheEntry *entry;
+  while ((entry = findEntry(hash, key)) != nullptr &&
+         entry->state == CacheState::Computing) {
+    if (!ownerAlive(entry->owner)) {
+      // The computation died with its process, so the entry is dropped and
+      // this lookup computes the result itself
+      freeEntry(*entry);
+      continue;
+    }
+    waited = true;
+    waitCache();
+  }
+  if (entry != nullptr) {
+    if (waited) {
+      result_cache->coalesced++;
+    } else {
+      result_cache->hits++;
+    }
+    unlinkRecent(*entry);
+    linkNewest(*entry);
+    loadResult(*entry, result);
+    pthread_mutex_unlock(&result_cache->mutex);
+    appendResult(frame, result, version);
+    patchUtilization(frame, offset, utilization);
+    return;
+  }
+
+  // Claim an entry so identical lookups wait for this computation
+  result_cache->misses++;
+  entry = victimEntry();
+  uint64_t ticket = ++result_cache->tickets;
+  if (entry != nullptr) {
+    entry->state = CacheState::Computing;
+    entry->owner = getpid();
+    entry->ticket = ticket;
+    entry->hash = hash;
+    entry->key_length = key.size();
+    memcpy(entry->key, key.data(), key.size());
+    linkBucket(*entry);
+  }
+  pthread_mutex_unlock(&result_cache->mutex);
+
+  computeResult(key, scratch.workspace, result);
+  appendResult(frame, result, version);
+  patchUtilization(frame, offset, utilization);
+  if (entry == nullptr) {
+    return;
+  }
+
+  lockCache();
+  // The claim is gone if the cache was emptied while computing
+  if (entry->state == CacheState::Computing && entry->ticket == ticket) {
+    if (storeResult(*entry, result)) {
+      entry->state = CacheState::Ready;
+      linkNewest(*entry);
+    } else {
+      freeEntry(*entry);
+    }
+  }
+  pthread_cond_broadcast(&result_cache->done);
+  pthread_mutex_unlock(&result_cache->mutex);
+}
+
+// Struct to hold the admission session of one connection: the admitted tasks
+// in priority order and the aggregates needed to admit the next task without
+// analyzing the whole set again. Every admitted set meets all its deadlines
+struct Session {
+  std::vector<Task> tasks;
+  // Lower bounds on the response times, 0 if unknown. Adding a task only
+  // adds interference, so a bound stays valid until a task is removed
+  std::vector<unsigned long long> floors;
+  std::vector<unsigned long long> candidate; // Response times being checked
+  double utilization = 0.0;
+  double hyperbolic = 1.0; // Product of (U_i + 1)
+  // Exact up to max_hyperperiod, past it only known to be too large
+  unsigned long long hyperperiod = 1;
+};
+
+// Function to find a session task by name, returns tasks.size() if absent
+size_t findSessionTask(const Session &session, char name) {
+  size_t i = 0;
+  while (i < session.tasks.size() && session.tasks[i].name != name) {
+    ++i;
+  }
+  return i;
+}
+
+// Function to admit a task into a session if every deadline is still met.
+// The utilization, Liu-Layland and hyperbolic tests are O(1) from the kept
+// aggregates. Only when they cannot decide is response-time analysis run,
+// and only for the new task and the tasks below it, starting from their
+// previous response times
+SessionStatus sessionAdd(Session &session, const Task &task) {
+  if (task.period == 0 ||
+      findSessionTask(session, task.name) < session.tasks.size()) {
+    return SessionStatus::Invalid;
+  }
+  double share = static_cast<double>(task.wcet) / task.period;
+  double utilization = session.utilization + share;
+  double hyperbolic = session.hyperbolic * (share + 1.0);
+  // Tasks with equal periods keep their arrival order, as in a task line
+  size_t position =
+      std::upper_bound(session.tasks.begin(), session.tasks.end(), task,
+                       compareTasks) -
+      session.tasks.begin();
+
+  // Rounding can push a set with utilization exactly 1 just above it, so
+  // only clear overloads are rejected here and analysis settles the rest
+  if (utilization > 1 + 1e-9) {
+    return SessionStatus::Rejected;
+  }
+  session.tasks.insert(session.tasks.begin() + position, task);
+  session.floors.insert(session.floors.begin() + position, 0);
+  if (utilization > liuLaylandThreshold(session.tasks.size()) &&
+      hyperbolic > 2.0) {
+    unsigned long long busy = 0;
+    for (size_t i = 0; i < position; ++i) {
+      busy += session.tasks[i].initial_wcet;
+    }
+    session.candidate.clear();
+    for (size_t i = position; i < session.tasks.size(); ++i) {
+      busy += session.tasks[i].initial_wcet;
+      unsigned long long response = responseTime(
+          session.tasks, i, std::max(busy, session.floors[i]));
+      if (response > session.tasks[i].period) {
+        session.tasks.erase(session.tasks.begin() + position);
+        session.floors.erase(session.floors.begin() + position);
+        return SessionStatus::Rejected;
       }
+      session.candidate.push_back(response);
     }
+    std::copy(session.candidate.begin(), session.candidate.end(),
+              session.floors.begin() + position);
+  }
+  session.utilization = utilization;
+  session.hyperbolic = hyperbolic;
+  if (session.hyperperiod <= max_hyperperiod) {
+    session.hyperperiod = lcm(session.hyperperiod, task.period);
+  }
+  return SessionStatus::Admitted;
+}
 
-    // Merge adjacent idle intervals
-    for (size_t i = 0; i < task_intervals.size() - 1; ++i) {
-      if (task_intervals[i].name == 'I' && task_intervals[i + 1].name == 'I') {
-        // Merge adjacent idle intervals
-        task_intervals[i].end = task_intervals[i + 1].end;
-        task_intervals.erase(task_intervals.begin() + i + 1);
-        --i; // Adjust index after erasing
+// Function to remove a task from a session. The sums are rebuilt rather than
+// subtracted so they never drift, and the hyperperiod only when no other
+// task shares the period of the removed one
+SessionStatus sessionRemove(Session &session, char name) {
+  size_t position = findSessionTask(session, name);
+  if (position == session.tasks.size()) {
+    return SessionStatus::NotFound;
+  }
+  std::vector<Task> &tasks = session.tasks;
+  unsigned period = tasks[position].period;
+  bool shared = (position > 0 && tasks[position - 1].period == period) ||
+                (position + 1 < tasks.size() &&
+                 tasks[position + 1].period == period);
+  tasks.erase(tasks.begin() + position);
+  session.floors.erase(session.floors.begin() + position);
+  std::fill(session.floors.begin() + position, session.floors.end(), 0);
+
+  session.utilization = 0.0;
+  session.hyperbolic = 1.0;
+  for (const auto &task : tasks) {
+    double share = static_cast<double>(task.wcet) / task.period;
+    session.utilization += share;
+    session.hyperbolic *= share + 1.0;
+  }
+  if (!shared) {
+    session.hyperperiod = 1;
+    for (size_t i = 0;
+         i < tasks.size() && session.hyperperiod <= max_hyperperiod; ++i) {
+      if (i == 0 || tasks[i].period != tasks[i - 1].period) {
+        session.hyperperiod = lcm(session.hyperperiod, tasks[i].period);
       }
     }
+  }
+  return SessionStatus::Removed;
+}
+
+// Function to run one session command and append its result to frame. A
+// diagram is only simulated for a query that asks for one
+void sessionCommand(const char *command, Session &session,
+                    Workspace &workspace, std::string &frame) {
+  SessionStatus status;
+  workspace.diagram.clear();
+  switch ((SessionOp)command[0]) {
+  case SessionOp::Add: {
+    unsigned wcet = getU32(command + 2);
+    status = sessionAdd(session, {command[1], wcet, getU32(command + 6), wcet});
+    break;
+  }
+  case SessionOp::Remove:
+    status = sessionRemove(session, command[1]);
+    break;
+  default:
+    status = SessionStatus::Schedulable;
+    if (!(command[1] & 1)) {
+      break;
+    }
+    if (needsWindow(session.hyperperiod, options)) {
+      status = SessionStatus::HyperperiodTooLarge;
+      break;
+    }
+    workspace.tasks = session.tasks;
+    simulateWindow(workspace.tasks, session.hyperperiod, options, workspace);
+  }
 
-    // Generate scheduling diagram string
-    std::string diagram = "";
-    char last_task = ' ';
-    for (const auto &interval : task_intervals) {
-      if (interval.name != 'I') {
-        diagram += interval.name;
-        diagram += "(" + std::to_string(interval.end - interval.start) + "), ";
-        last_task = interval.name;
+  uint64_t utilization_bits;
+  memcpy(&utilization_bits, &session.utilization, sizeof(double));
+  putU8(frame, (unsigned char)status);
+  putU64(frame, utilization_bits);
+  putU64(frame,
+         session.hyperperiod > max_hyperperiod ? 0 : session.hyperperiod);
+  putU32(frame, session.tasks.size());
+  encodeDiagram(frame, workspace.diagram);
+}
+
+// Function to dump the metrics as text, one "name value" line each
+std::string metricsText() {
+  std::stringstream text;
+  ServerMetrics &m = *metrics;
+  text << "connections " << m.connections << "\nrequests " << m.requests
+       << "\ntask_sets " << m.task_sets << "\nsession_commands "
+       << m.session_commands << "\nin_flight " << m.in_flight
+       << "\nbytes_in " << m.bytes_in << "\nbytes_out " << m.bytes_out
+       << "\nshared_rings " << m.shared_rings << "\n";
+  for (size_t i = 0; i < error_count; ++i) {
+    text << "errors{cause=\"" << error_names[i] << "\"} " << m.errors[i]
+         << "\n";
+  }
+  if (result_cache != nullptr) {
+    lockCache();
+    text << "cache_hits " << result_cache->hits << "\ncache_misses "
+         << result_cache->misses << "\ncache_coalesced "
+         << result_cache->coalesced << "\ncache_evictions "
+         << result_cache->evictions << "\n";
+    pthread_mutex_unlock(&result_cache->mutex);
+  }
+  for (size_t i = 0; i < stage_count; ++i) {
+    const Histogram &histogram = m.stages[i];
+    uint64_t cumulative = 0;
+    for (size_t bucket = 0; bucket < histogram_buckets; ++bucket) {
+      cumulative += histogram.buckets[bucket];
+      text << "latency_us{stage=\"" << stage_names[i] << "\",le=\"";
+      if (bucket + 1 < histogram_buckets) {
+        text << (1ULL << bucket);
       } else {
-        if (last_task != 'I') {
-          diagram +=
-              "Idle(" + std::to_string(interval.end - interval.start) + "), ";
-          last_task = 'I';
+        text << "+Inf";
+      }
+      text << "\"} " << cumulative << "\n";
+    }
+    text << "latency_us_sum{stage=\"" << stage_names[i] << "\"} "
+         << histogram.total_ns / 1000 << "\nlatency_us_count{stage=\""
+         << stage_names[i] << "\"} " << histogram.count << "\n";
+  }
+  return text.str();
+}
+
+// Stats thread function, answers every connection to the stats port with the
+// current metrics and closes it
+void *stats_function(void *arguments) {
+  int statsfd = (int)(intptr_t)arguments;
+  while (true) {
+    int fd = accept(statsfd, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    std::string text = metricsText();
+    writeAll(fd, text.data(), text.size());
+    close(fd);
+  }
+  return nullptr;
+}
+
+// Function to send a reply frame over the rings of the connection once they
+// are attached, or over its socket
+bool sendFrame(int fd, SharedRings &rings, const std::string &frame) {
+  if (!rings.attached()) {
+    return writeAll(fd, frame.data(), frame.size());
+  }
+  if (!ringWrite(rings.replies, frame.data(), frame.size(), fd)) {
+    return false;
+  }
+  addCount(metrics->bytes_out, frame.size());
+  return true;
+}
+
+// Most connections a process serves over shared-memory rings at once. In the
+// epoll mode each of them holds a thread of its own, so attaching more is
+// refused and those clients stay on the socket
+const size_t max_ring_connections = 32;
+size_t ring_connections = 0;
+
+// Function to take a ring connection slot, false if all of them are taken
+bool reserveRingConnection() {
+  if (__atomic_add_fetch(&ring_connections, 1, __ATOMIC_RELAXED) >
+      max_ring_connections) {
+    __atomic_sub_fetch(&ring_connections, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  return true;
+}
+
+// Function to unmap the rings of a connection and give back its slot
+void releaseRings(SharedRings &rings) {
+  if (rings.attached()) {
+    unmapSharedRings(rings);
+    __atomic_sub_fetch(&ring_connections, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// Function to answer every complete frame at the front of buffer. The first
+// bytes of the oldest frame arrived at frame_start, which is moved forward as
+// frames are answered, and check keeps how far that frame has been checked.
+// A version 3 frame attaches rings, and answering stops there since the next
+// frames come through them
+bool answerFrames(int fd, std::string &buffer, uint64_t &frame_start,
+                  FrameCheck &check, FrameScratch &scratch, Session &session,
+                  SharedRings &rings) {
+  std::vector<std::pair<size_t, size_t>> &lines = scratch.lines;
+  std::string &frame = scratch.workspace.output;
+  bool malformed;
+  size_t size;
+  uint64_t parsing = nowNs();
+  while ((size = parseFrame(buffer, nullptr, malformed, &check)) > 0) {
+    parseFrame(buffer, &lines, malformed);
+    uint64_t parsed = nowNs();
+    recordStage(Stage::Read, frame_start, parsing);
+    recordStage(Stage::Parse, parsing, parsed);
+    addCount(metrics->in_flight);
+
+    unsigned char version = buffer[sizeof(protocol_magic)];
+    startFrame(frame, version, lines.size());
+    SharedRings attaching;
+    if (version == ring_version) {
+      bool opened = lines.size() == 1 && !rings.attached() &&
+                    isUnixSocket(fd) && peerIsUser(fd) &&
+                    reserveRingConnection();
+      if (opened && !openSharedRings(buffer.substr(lines[0].first,
+                                                   lines[0].second),
+                                     attaching)) {
+        __atomic_sub_fetch(&ring_connections, 1, __ATOMIC_RELAXED);
+        opened = false;
+      }
+      startFrame(frame, version, 1);
+      putU8(frame, opened ? 0 : 1);
+      lines.clear();
+    }
+    for (const auto &line : lines) {
+      if (version == session_version) {
+        sessionCommand(buffer.data() + line.first, session, scratch.workspace,
+                       frame);
+        continue;
+      }
+      scratch.line.assign(buffer, line.first, line.second);
+      cachedResult(scratch.line, scratch, frame, version);
+    }
+    buffer.erase(0, size);
+    uint64_t writing = nowNs();
+    bool written = sendFrame(fd, rings, frame);
+    recordStage(Stage::Write, writing, nowNs());
+
+    __atomic_fetch_sub(&metrics->in_flight, 1, __ATOMIC_RELAXED);
+    addCount(metrics->requests);
+    addCount(version == session_version ? metrics->session_commands
+                                        : metrics->task_sets,
+             lines.size());
+    if (!written) {
+      countError(ErrorCause::Write);
+      std::cerr << "Error writing to socket" << std::endl;
+      releaseRings(attaching);
+      return false;
+    }
+    parsing = frame_start = nowNs();
+    if (attaching.attached()) {
+      rings = attaching;
+      addCount(metrics->shared_rings);
+      return true;
+    }
+  }
+  if (malformed) {
+    countError(ErrorCause::Malformed);
+  }
+  return !malformed;
+}
+
+// Function to answer the frames of a connection that attached rings until
+// the client closes its request ring or the connection. A client that moves
+// the cursors of the rings where they cannot be is cut off
+void serveRings(int fd, std::string &buffer, uint64_t &frame_start,
+                FrameCheck &check, FrameScratch &scratch, Session &session,
+                SharedRings &rings) {
+  char chunk[65536];
+  size_t n;
+  while ((n = ringRead(rings.requests, chunk, sizeof(chunk), fd)) > 0) {
+    if (buffer.empty()) {
+      frame_start = nowNs();
+    }
+    buffer.append(chunk, n);
+    addCount(metrics->bytes_in, n);
+    if (!answerFrames(fd, buffer, frame_start, check, scratch, session,
+                      rings)) {
+      break;
+    }
+  }
+  if (rings.requests.corrupt || rings.replies.corrupt) {
+    countError(ErrorCause::Malformed);
+    std::cerr << "Shared rings corrupted by the client" << std::endl;
+  }
+  ringClose(rings.replies);
+  releaseRings(rings);
+}
+
+// Struct to hold a client connection and the bytes read but not yet
+// answered, or one of the listening sockets
+struct Connection {
+  int fd = -1;
+  bool listening = false;
+  std::string buffer;
+  bool closing = false;    // The client closed its side after sending
+  uint64_t frame_start = 0; // When the first unanswered byte arrived
+  FrameCheck check;
+  Session session;
+  SharedRings rings;
+};
+
+// Ring thread function, serves a connection that attached rings on its own,
+// since waiting on the rings would block a compute thread
+void *ring_function(void *arguments) {
+  Connection *connection = static_cast<Connection *>(arguments);
+  FrameScratch scratch;
+  serveRings(connection->fd, connection->buffer, connection->frame_start,
+             connection->check, scratch, connection->session,
+             connection->rings);
+  close(connection->fd);
+  delete connection;
+  return nullptr;
+}
+
+// Struct to hold connections with complete frames waiting for a compute thread
+struct RequestQueue {
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  std::deque<Connection *> connections;
+  int epollfd;
+};
+
+// Compute thread function, answers the frames of queued connections and hands
+// each connection back to the epoll loop, so frames pipelined on one
+// connection are answered in order
+void *compute_function(void *arguments) {
+  RequestQueue &queue = *static_cast<RequestQueue *>(arguments);
+  FrameScratch scratch;
+  while (true) {
+    pthread_mutex_lock(&queue.mutex);
+    while (queue.connections.empty()) {
+      pthread_cond_wait(&queue.not_empty, &queue.mutex);
+    }
+    Connection *connection = queue.connections.front();
+    queue.connections.pop_front();
+    pthread_mutex_unlock(&queue.mutex);
+
+    fcntl(connection->fd, F_SETFL,
+          fcntl(connection->fd, F_GETFL) & ~O_NONBLOCK);
+    bool open = answerFrames(connection->fd, connection->buffer,
+                             connection->frame_start, connection->check,
+                             scratch, connection->session, connection->rings);
+    if (open && connection->rings.attached()) {
+      // The connection leaves the epoll set for good
+      pthread_t thread;
+      if (pthread_create(&thread, nullptr, ring_function, connection) == 0) {
+        pthread_detach(thread);
+        continue;
+      }
+      std::cerr << "Error creating ring thread" << std::endl;
+      ringClose(connection->rings.replies);
+      releaseRings(connection->rings);
+      open = false;
+    }
+    if (!open || connection->closing) {
+      close(connection->fd);
+      delete connection;
+      continue;
+    }
+    fcntl(connection->fd, F_SETFL, fcntl(connection->fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = connection;
+    epoll_ctl(queue.epollfd, EPOLL_CTL_MOD, connection->fd, &event);
+  }
+  return nullptr;
+}
+
+// Function to serve requests from one epoll loop that accepts connections
+// and reads them without blocking, handing connections with complete frames
+// to a fixed pool of compute threads
+void serveEpoll(const std::vector<int> &listeners, size_t workers) {
+  RequestQueue queue;
+  pthread_mutex_init(&queue.mutex, nullptr);
+  pthread_cond_init(&queue.not_empty, nullptr);
+  queue.epollfd = epoll_create1(0);
+  if (queue.epollfd < 0) {
+    std::cerr << "Error creating epoll instance" << std::endl;
+    exit(0);
+  }
+  for (size_t i = 0; i < workers; ++i) {
+    pthread_t thread;
+    pthread_create(&thread, nullptr, compute_function, &queue);
+    pthread_detach(thread);
+  }
+
+  // Pre-forked workers share the AF_UNIX listener, and EPOLLEXCLUSIVE wakes
+  // only one of them per connection
+  struct epoll_event event;
+  for (int listener : listeners) {
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    Connection *connection = new Connection();
+    connection->fd = listener;
+    connection->listening = true;
+    event.data.ptr = connection;
+    epoll_ctl(queue.epollfd, EPOLL_CTL_ADD, listener, &event);
+  }
+
+  std::vector<struct epoll_event> events(64);
+  char chunk[4096];
+
+  while (true) {
+    int ready = epoll_wait(queue.epollfd, events.data(), events.size(), -1);
+    for (int e = 0; e < ready; ++e) {
+      Connection *connection = static_cast<Connection *>(events[e].data.ptr);
+      if (connection->listening) {
+        // Accept every connection waiting in the backlog
+        int newsockfd;
+        while ((newsockfd = accept4(connection->fd, nullptr, nullptr,
+                                    SOCK_NONBLOCK)) >= 0) {
+          uint64_t accepted = nowNs();
+          event.events = EPOLLIN | EPOLLONESHOT;
+          Connection *accepting = new Connection();
+          accepting->fd = newsockfd;
+          event.data.ptr = accepting;
+          epoll_ctl(queue.epollfd, EPOLL_CTL_ADD, newsockfd, &event);
+          recordStage(Stage::Accept, accepted, nowNs());
+          addCount(metrics->connections);
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          countError(ErrorCause::Accept);
+        }
+        continue;
+      }
+
+      // Read what is available and check for a complete frame. Reading stops
+      // once a whole frame of the largest size could be in the buffer, the
+      // rest waits in the socket until the frames before it are answered
+      ssize_t n;
+      while ((n = read(connection->fd, chunk, sizeof(chunk))) > 0) {
+        if (connection->buffer.empty()) {
+          connection->frame_start = nowNs();
+        }
+        connection->buffer.append(chunk, n);
+        addCount(metrics->bytes_in, n);
+        if (connection->buffer.size() >= max_frame_size) {
+          break;
         }
       }
+      connection->closing =
+          n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+      if (n < 0 && connection->closing) {
+        countError(ErrorCause::Read);
+      }
+      bool malformed;
+      bool complete = parseFrame(connection->buffer, nullptr, malformed,
+                                 &connection->check) > 0;
+
+      if (complete) {
+        pthread_mutex_lock(&queue.mutex);
+        queue.connections.push_back(connection);
+        pthread_cond_signal(&queue.not_empty);
+        pthread_mutex_unlock(&queue.mutex);
+      } else if (connection->closing || malformed) {
+        if (malformed) {
+          countError(ErrorCause::Malformed);
+        }
+        close(connection->fd);
+        delete connection;
+      } else {
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = connection;
+        epoll_ctl(queue.epollfd, EPOLL_CTL_MOD, connection->fd, &event);
+      }
     }
-    // Remove trailing comma and space
-    diagram.pop_back();
-    diagram.pop_back();
+  }
+}
 
-    returnString << diagram;
+// Function to open a TCP socket bound to address that other sockets can bind
+// as well with SO_REUSEPORT, returns -1 on failure
+int bindReusePort(const struct sockaddr_in &address) {
+  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  if (sockfd < 0 ||
+      setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) <
+          0 ||
+      bind(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    if (sockfd >= 0) {
+      close(sockfd);
+    }
+    return -1;
   }
-  return returnString.str();
+  return sockfd;
 }
 
-void fireman(int) {
-  while (waitpid(-1, NULL, WNOHANG) > 0)
-    ;
+// Function to start a pre-forked worker. It listens on its own SO_REUSEPORT
+// socket, so the kernel spreads new connections across the workers instead
+// of one process accepting them all, and answers them in its own epoll loop
+// with no fork per connection. Any AF_UNIX listener is shared by all workers
+pid_t startWorker(const struct sockaddr_in &address, int backlog, int unixfd,
+                  size_t threads) {
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+  // A worker left behind by a killed server would keep the port
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  int sockfd = bindReusePort(address);
+  if (sockfd < 0) {
+    std::cerr << "Error binding" << std::endl;
+    exit(0);
+  }
+  listen(sockfd, backlog);
+  std::vector<int> listeners = {sockfd};
+  if (unixfd >= 0) {
+    listeners.push_back(unixfd);
+  }
+  serveEpoll(listeners, threads);
+  exit(0);
+}
+
+// Function to keep count pre-forked workers running, a worker that exits is
+// replaced by a new one
+void servePrefork(const struct sockaddr_in &address, int backlog, int unixfd,
+                  size_t count, size_t threads) {
+  worker_pids.assign(count, 0);
+  for (size_t i = 0; i < count; ++i) {
+    worker_pids[i] = startWorker(address, backlog, unixfd, threads);
+  }
+  while (true) {
+    pid_t pid = wait(nullptr);
+    if (pid < 0) {
+      if (errno == ECHILD) {
+        exit(0);
+      }
+      continue;
+    }
+    for (auto &worker : worker_pids) {
+      if (worker == pid) {
+        worker = startWorker(address, backlog, unixfd, threads);
+      }
+    }
+  }
 }
 
 //Function below is based off of Rincon boiler plate server.cpp file
 
 int main(int argc, char *argv[]) {
 
-  int sockfd, newsockfd, portno, clilen;
-  struct sockaddr_in serv_addr, cli_addr;
+  int sockfd, newsockfd, portno;
+  struct sockaddr_in serv_addr;
+  bool use_epoll = false;
+  bool use_unix = true;
+  size_t workers = 0;
+  int backlog = 5;
+  size_t prefork = 0;
+  size_t cache_entries = 1024;
+  int stats_port = 0;
 
   // Check the commandline arguments
-  if (argc != 2) {
+  if (argc < 2) {
     std::cerr << "Port not provided" << std::endl;
     exit(0);
   }
+  for (int i = 2; i < argc; ++i) {
+    OptionStatus status = readAnalysisOption(argc, argv, i, options);
+    if (status == OptionStatus::Invalid) {
+      exit(0);
+    }
+    if (status == OptionStatus::Read) {
+      continue;
+    }
+    std::string arg = argv[i];
+    if (arg == "--epoll") {
+      use_epoll = true;
+    } else if (arg == "--workers" && i + 1 < argc) {
+      workers = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--prefork") {
+      // Optional count, one worker per core by default
+      prefork = sysconf(_SC_NPROCESSORS_ONLN);
+      if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0])) {
+        prefork = std::strtoul(argv[++i], nullptr, 10);
+      }
+      prefork = std::max<size_t>(prefork, 1);
+    } else if (arg == "--backlog" && i + 1 < argc) {
+      backlog = std::atoi(argv[++i]);
+    } else if (arg == "--cache" && i + 1 < argc) {
+      cache_entries = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--stats-port" && i + 1 < argc) {
+      stats_port = std::atoi(argv[++i]);
+    } else if (arg == "--no-unix") {
+      use_unix = false;
+    }
+  }
+
+  if (cache_entries > 0 && !createCache(cache_entries)) {
+    std::cerr << "Error creating the result cache" << std::endl;
+    exit(0);
+  }
+  if (!createMetrics()) {
+    std::cerr << "Error creating the metrics" << std::endl;
+    exit(0);
+  }
+
+  // Serve the metrics as text on a loopback-only port
+  if (stats_port > 0) {
+    int statsfd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1; // The server closes first, so restarts meet TIME_WAIT
+    setsockopt(statsfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in stats_addr;
+    bzero((char *)&stats_addr, sizeof(stats_addr));
+    stats_addr.sin_family = AF_INET;
+    stats_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    stats_addr.sin_port = htons(stats_port);
+    if (statsfd < 0 ||
+        bind(statsfd, (struct sockaddr *)&stats_addr, sizeof(stats_addr)) < 0) {
+      std::cerr << "Error binding the stats port" << std::endl;
+      exit(0);
+    }
+    listen(statsfd, 5);
+    pthread_t thread;
+    pthread_create(&thread, nullptr, stats_function, (void *)(intptr_t)statsfd);
+    pthread_detach(thread);
+  }
 
   // Create the socket
   sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -204,56 +1541,144 @@ int main(int argc, char *argv[]) {
   serv_addr.sin_addr.s_addr = INADDR_ANY;
   serv_addr.sin_port = htons(portno);
 
-  // Bind the socket with the sockaddr_in structure
+  // Bind the socket with the sockaddr_in structure. This bind takes no
+  // SO_REUSEPORT even when pre-forking, so it fails while any other server
+  // holds the port instead of quietly sharing its connections
   if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
     std::cerr << "Error binding" << std::endl;
     exit(0);
   }
 
+  // Pre-forked workers bind the port again with SO_REUSEPORT, this socket
+  // holds the port for them without listening, so no connection waits on it.
+  // A server starting between the two binds takes the port plainly, then
+  // this one fails here rather than sharing it
+  if (prefork > 0) {
+    close(sockfd);
+    sockfd = bindReusePort(serv_addr);
+    if (sockfd < 0) {
+      std::cerr << "Error binding" << std::endl;
+      exit(0);
+    }
+  }
+
   // Set the max number of concurrent connections
-  listen(sockfd, 5);
-  clilen = sizeof(cli_addr);
+  std::vector<int> listeners = {sockfd};
+  if (prefork == 0) {
+    listen(sockfd, backlog);
+  }
+
+  // Listen on an AF_UNIX socket named after the port as well, clients on this
+  // host connect there to skip the TCP loopback stack. The socket lives in a
+  // directory private to this user, so a socket file left there by an
+  // earlier server is replaced, the TCP bind above already made sure no
+  // server is running on this port
+  if (use_unix) {
+    std::string path = unixSocketPath(argv[1], true);
+    struct sockaddr_un unix_addr;
+    bzero((char *)&unix_addr, sizeof(unix_addr));
+    unix_addr.sun_family = AF_UNIX;
+    strncpy(unix_addr.sun_path, path.c_str(), sizeof(unix_addr.sun_path) - 1);
+    int unixfd = path.empty() ? -1 : socket(AF_UNIX, SOCK_STREAM, 0);
+    if (unixfd >= 0) {
+      unlink(path.c_str());
+    }
+    if (unixfd < 0 ||
+        bind(unixfd, (struct sockaddr *)&unix_addr, sizeof(unix_addr)) < 0) {
+      std::cerr << "No private directory for the AF_UNIX socket, serving TCP "
+                   "only"
+                << std::endl;
+      if (unixfd >= 0) {
+        close(unixfd);
+      }
+      use_unix = false;
+    } else {
+      unix_path = path;
+      listen(unixfd, backlog);
+      listeners.push_back(unixfd);
+    }
+  }
+  server_pid = getpid();
+  signal(SIGTERM, stopServer);
+  signal(SIGINT, stopServer);
 
+  if (prefork > 0) {
+    servePrefork(serv_addr, backlog, use_unix ? listeners.back() : -1, prefork,
+                 std::max<size_t>(workers, 1));
+  }
+
+  if (use_epoll) {
+    if (workers == 0) {
+      long cores = sysconf(_SC_NPROCESSORS_ONLN);
+      workers = cores > 0 ? cores : 1;
+    }
+    serveEpoll(listeners, workers);
+  }
+
+  std::vector<struct pollfd> ready;
+  for (int listener : listeners) {
+    ready.push_back({listener, POLLIN, 0});
+  }
   signal(SIGCHLD, fireman);
   while (true) {
-    // Accept a new connection
-    newsockfd =
-        accept(sockfd, (struct sockaddr *)&cli_addr, (socklen_t *)&clilen);
-    if (fork() == 0) {
-
-      if (newsockfd < 0) {
-        std::cerr << "Error accepting new connections" << std::endl;
-        exit(0);
-      }
-      int n, msgSize = 0;
-      n = read(newsockfd, &msgSize, sizeof(int));
-      if (n < 0) {
-        std::cerr << "Error reading from socket" << std::endl;
-        exit(0);
-      }
-      char *tempBuffer = new char[msgSize + 1];
-      bzero(tempBuffer, msgSize + 1);
-      n = read(newsockfd, tempBuffer, msgSize + 1);
-      if (n < 0) {
-        std::cerr << "Error reading from socket"
-                  << " server side" << std::endl;
-        exit(0);
+    // Wait for a connection on either socket, SIGCHLD interrupts the wait
+    if (poll(ready.data(), ready.size(), -1) <= 0) {
+      continue;
+    }
+    for (const auto &listener : ready) {
+      if (!(listener.revents & POLLIN)) {
+        continue;
       }
-      std::string buffer = tempBuffer;
-      delete[] tempBuffer;
-
-      buffer = calculations(buffer);
-      msgSize = buffer.size();
-      n = write(newsockfd, &msgSize, sizeof(int));
-      if (n < 0) {
-        std::cerr << "Error writing to socket" << std::endl;
+      // Accept a new connection
+      newsockfd = accept(listener.fd, nullptr, nullptr);
+      uint64_t accepted = nowNs();
+      pid_t pid = fork();
+      if (pid == 0) {
+
+        if (newsockfd < 0) {
+          countError(ErrorCause::Accept);
+          std::cerr << "Error accepting new connections" << std::endl;
+          exit(0);
+        }
+        // Answer frames until the client closes the connection
+        std::string buffer;
+        uint64_t frame_start = 0;
+        FrameCheck check;
+        FrameScratch scratch;
+        Session session;
+        SharedRings rings;
+        char chunk[4096];
+        int n;
+        while ((n = read(newsockfd, chunk, sizeof(chunk))) > 0) {
+          if (buffer.empty()) {
+            frame_start = nowNs();
+          }
+          buffer.append(chunk, n);
+          addCount(metrics->bytes_in, n);
+          if (!answerFrames(newsockfd, buffer, frame_start, check, scratch,
+                            session, rings)) {
+            break;
+          }
+          if (rings.attached()) {
+            serveRings(newsockfd, buffer, frame_start, check, scratch, session,
+                       rings);
+            break;
+          }
+        }
+        if (n < 0) {
+          countError(ErrorCause::Read);
+          std::cerr << "Error reading from socket" << std::endl;
+        }
+        close(newsockfd);
         exit(0);
       }
-      n = write(newsockfd, buffer.c_str(), msgSize);
-      if (n < 0) {
-        std::cerr << "Error writing to socket" << std::endl;
-        exit(0);
+      if (pid < 0) {
+        countError(ErrorCause::Fork);
+      } else if (newsockfd >= 0) {
+        recordStage(Stage::Accept, accepted, nowNs());
+        addCount(metrics->connections);
       }
+      close(newsockfd);
     }
   }
   close(newsockfd);
@@ -1,253 +1,288 @@
 #include <algorithm>
 #include <cmath>
-#include <iomanip>
+#include <deque>
 #include <iostream>
+#include <limits>
 #include <pthread.h>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unistd.h>
 #include <vector>
 
-// Struct to hold task information
-struct Task {
-    char name;
-    unsigned wcet;
-    unsigned period;
-    unsigned initial_wcet; // We need to store initial WCET for reset
-};
+#include "RMEngine.h"
 
-// Struct to hold task interval information
-struct TaskInterval {
-    char name;
-    unsigned start;
-    unsigned end;
-    bool stopped; // Represents if the task was interrupted
+// Struct to hold finished outputs until every earlier line has been printed
+struct ReorderBuffer {
+    std::vector<std::string> slots;
+    std::vector<char> ready; // Per-slot readiness
+    size_t next = 0;         // First slot that has not been printed yet
+    bool flushing = false;   // A thread is printing outside the lock
 };
 
 // Struct to hold arguments for pthread function
 struct Arguments {
-    std::string input;
-    std::string* output;
     size_t iteration;
 
-    std::vector<Task> tasks;
-    std::vector<TaskInterval> task_intervals;
-
     pthread_mutex_t *mutex;
     pthread_mutex_t *mutex2;
-    pthread_cond_t *condition;
-    int *counter;
+    ReorderBuffer *reorder;
 
-    std::string i = "";
+    std::string_view i;
 
 
 };
 
-// Function to calculate the greatest common divisor (GCD) using Euclidean algorithm
-unsigned long long gcd(unsigned long long a, unsigned long long b) {
-    while (b != 0) {
-        unsigned long long temp = b;
-        b = a % b;
-        a = temp;
-    }
-    return a;
-}
-
-// Function to calculate the least common multiple (LCM) using GCD
-unsigned long long lcm(unsigned long long a, unsigned long long b) {
-    return (a * b) / gcd(a, b);
-}
+// Options of the line analysis
+AnalysisOptions options;
 
-// Function to compare tasks based on their periods
-bool compareTasks(const Task& a, const Task& b) {
-    return a.period < b.period;
-}
+// Streams the input through a bounded reader/worker/writer pipeline instead of
+// starting one thread per line
+bool stream_pipeline = false;
 
-void outputInfo(std::stringstream & entropy_values_sstr, std::vector<Task> tasks, size_t iteration, unsigned hyperperiod, double utilization)
-{
-  entropy_values_sstr << "CPU " << iteration
-                      << "\nTask scheduling information: ";
-  for (size_t i = 0; i < tasks.size(); ++i) {
-      entropy_values_sstr << tasks[i].name << " (WCET: " << tasks[i].wcet
-                          << ", Period: " << tasks[i].period << ")";
-      if (i < tasks.size() - 1) {
-          entropy_values_sstr << ", ";
-      }
-  }
-  entropy_values_sstr << "\nTask set utilization: " << std::setprecision(2)
-                      << std::fixed << utilization;
-  entropy_values_sstr << "\nHyperperiod: " << hyperperiod;
-}
+//Reference: Professor Rincon example code.
+//           Exam 2 code
 
-// Function to parse input and calculate hyperperiod, utilization, and generate scheduling diagram
-std::string parse(const std::string& input, size_t iteration, std::vector<Task> & tasks, std::vector<TaskInterval> & task_intervals) {
-    std::stringstream input_string(input);
-    std::stringstream entropy_values_sstr;
-    //std::vector<Task> tasks;
-    char task_name;
-    unsigned task_wcet;
-    unsigned task_period;
-
-    // Parse input string
-    while (input_string >> task_name >> task_wcet >> task_period) {
-        tasks.push_back({task_name, task_wcet, task_period, task_wcet});
-    }
+// Thread function
+void* thread_function(void* arguments) {
+    Arguments argPtr = *(Arguments*) arguments;
 
-    // Calculate hyperperiod
-    unsigned hyperperiod = 1;
-    for (const auto& task : tasks) {
-        hyperperiod = lcm(hyperperiod, task.period);
-    }
+    pthread_mutex_unlock(argPtr.mutex);
 
-    // Calculate utilization
-    double utilization = 0.0;
-    for (const auto& task : tasks) {
-        utilization += static_cast<double>(task.wcet) / task.period;
-    }
+    // Every line has a thread of its own, one line can still spread its slacks
+    analysis_worker = argPtr.reorder->slots.size() > 1;
+    Workspace workspace;
+    analyzeLine(argPtr.i, argPtr.iteration, options, workspace);
 
-    // Output task scheduling information
-   outputInfo(entropy_values_sstr, tasks, iteration, hyperperiod, utilization);
-
-  // Sort tasks based on their periods
-  std::sort(tasks.begin(), tasks.end(), compareTasks);
-
-    // Check schedulability
-    double threshold = tasks.size() * (std::pow(2.0, 1.0 / tasks.size()) - 1);
-    if (utilization > 1) {
-        entropy_values_sstr << "\nRate Monotonic Algorithm execution for CPU"
-            << iteration << ":" << "\nThe task set is not schedulable";
-    } else if (utilization > threshold || utilization < 0) {
-        entropy_values_sstr <<"\nRate Monotonic Algorithm execution for CPU"
-            << iteration << ":" << "\nTask set schedulability is unknown";
-    } else {
-        entropy_values_sstr << "\nRate Monotonic Algorithm execution for CPU"
-                            << iteration << ":";
-
-        // Generate scheduling diagram
-        //std::vector<TaskInterval> task_intervals;
-        for (unsigned tick = 0; tick < hyperperiod; ++tick) {
-            bool task_running = false;
-            for (auto& task : tasks) {
-                if (tick % task.period == 0) {
-                    task.wcet = task.initial_wcet; // Reset WCET
-                    for (auto& interval : task_intervals) {
-                        //if (interval.name == task.name) {
-                            interval.stopped = true; // Reset stopped flag
-                        //}
-                    }
-                }
-            }
-            for (auto& task : tasks) {
-                if (task.wcet > 0) {
-                    task_running = true;
-                    if (task.wcet == task.initial_wcet) {
-                        // Fresh task, create new interval
-                        task_intervals.push_back({task.name, tick, tick + 1, false});
-                    } else {
-                        // Task still running, extend interval or create new one
-                        bool found = false;
-                        for (auto& interval : task_intervals) {
-                            if (interval.name == task.name && !interval.stopped) {
-                                interval.end = tick + 1; // Extend interval
-                                found = true;
-                                break;
-                            }
-                        }
-                        if (!found) {
-                            task_intervals.push_back({task.name, tick, tick + 1, false});
-                        }
-                    }
-                    --task.wcet;
-                    break; // Move to next tick
-                }
+    // Deposit the output in its slot, whoever fills the next slot to print
+    // flushes every consecutive ready output so no thread waits on another
+    ReorderBuffer& reorder = *argPtr.reorder;
+    pthread_mutex_lock(argPtr.mutex2);
+    reorder.slots[argPtr.iteration - 1] = std::move(workspace.output);
+    reorder.ready[argPtr.iteration - 1] = 1;
+    if (!reorder.flushing) {
+        reorder.flushing = true;
+        while (true) {
+            std::string batch;
+            while (reorder.next < reorder.slots.size() && reorder.ready[reorder.next]) {
+                batch += reorder.slots[reorder.next] + "\n\n\n";
+                std::string().swap(reorder.slots[reorder.next]);
+                reorder.next++;
             }
-            if (!task_running) {
-                // No task is running at this time, insert idle interval
-                task_intervals.push_back({'I', tick, tick + 1, false});
+            if (batch.empty()) {
+                break;
             }
+            pthread_mutex_unlock(argPtr.mutex2);
+            std::cout << batch << std::flush;
+            pthread_mutex_lock(argPtr.mutex2);
         }
+        reorder.flushing = false;
+    }
+    pthread_mutex_unlock(argPtr.mutex2);
 
-        // Merge adjacent idle intervals
-        for (size_t i = 0; i < task_intervals.size() - 1; ++i) {
-            if (task_intervals[i].name == 'I' && task_intervals[i + 1].name == 'I') {
-                // Merge adjacent idle intervals
-                task_intervals[i].end = task_intervals[i + 1].end;
-                task_intervals.erase(task_intervals.begin() + i + 1);
-                --i; // Adjust index after erasing
-            }
-        }
+    return nullptr;
 
-        // Generate scheduling diagram string
-        std::string diagram = "Scheduling Diagram for CPU " + std::to_string(iteration) + ": ";
-        char last_task = ' ';
-        for (const auto& interval : task_intervals) {
-            if (interval.name != 'I') {
-                diagram += interval.name;
-                diagram += "(" + std::to_string(interval.end - interval.start) + "), ";
-                last_task = interval.name;
-            } else {
-                if (last_task != 'I') {
-                    diagram += "Idle(" + std::to_string(interval.end - interval.start) + "), ";
-                    last_task = 'I';
-                }
-            }
-        }
-        // Remove trailing comma and space
-        diagram.pop_back();
-        diagram.pop_back();
+}
 
-        entropy_values_sstr << "\n" << diagram;
-    }
+// Struct to hold one line waiting for a pipeline worker. A line read from
+// stdin is owned by the job, a line of a mapped file is a view into it
+struct Job {
+    size_t index;
+    std::string text;
+    std::string_view line;
+};
 
-    return entropy_values_sstr.str();
-}
+// Struct to hold the lines waiting for a pipeline worker, the reader blocks
+// while it is full so memory use does not depend on the input size
+struct JobQueue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    std::deque<Job> jobs;
+    size_t capacity;
+    bool closed = false;
+};
 
-//Reference: Professor Rincon example code.
-//           Exam 2 code
+// Struct to hold finished pipeline outputs in a ring until the writer prints
+// them, a line is only read once its slot in the ring is free
+struct OutputRing {
+    pthread_mutex_t mutex;
+    pthread_cond_t slot_ready;
+    pthread_cond_t slot_free;
+    std::vector<std::string> slots;
+    std::vector<char> ready;
+    size_t next = 0;                                        // Next line to print
+    size_t total = std::numeric_limits<size_t>::max();      // Known at end of input
+};
 
-// Thread function
-void* thread_function(void* arguments) {
-    Arguments argPtr = *(Arguments*) arguments;
+// Struct to hold arguments for the pipeline threads
+struct PipelineArguments {
+    JobQueue *queue;
+    OutputRing *ring;
+};
 
-    std::string localInput = argPtr.i;
-    int localIteration = argPtr.iteration-1;
+// Pipeline worker function, analyzes lines until the reader closes the queue
+void* pipeline_worker(void* arguments) {
+    PipelineArguments* args = static_cast<PipelineArguments*>(arguments);
+    JobQueue& queue = *args->queue;
+    OutputRing& ring = *args->ring;
+    analysis_worker = true;
+    Workspace workspace;
+
+    while (true) {
+        pthread_mutex_lock(&queue.mutex);
+        while (queue.jobs.empty() && !queue.closed) {
+            pthread_cond_wait(&queue.not_empty, &queue.mutex);
+        }
+        if (queue.jobs.empty()) {
+            pthread_mutex_unlock(&queue.mutex);
+            break;
+        }
+        Job job = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+        pthread_cond_signal(&queue.not_full);
+        pthread_mutex_unlock(&queue.mutex);
+
+        analyzeLine(job.text.empty() ? job.line : job.text, job.index + 1, options,
+                    workspace);
+
+        // Swapping hands the worker the buffer the writer last returned, so
+        // output buffers circulate instead of being allocated per line
+        pthread_mutex_lock(&ring.mutex);
+        size_t slot = job.index % ring.slots.size();
+        ring.slots[slot].swap(workspace.output);
+        ring.ready[slot] = 1;
+        if (job.index == ring.next) {
+            pthread_cond_signal(&ring.slot_ready);
+        }
+        pthread_mutex_unlock(&ring.mutex);
+    }
+    return nullptr;
+}
 
-    pthread_mutex_unlock(argPtr.mutex);
+// Pipeline writer function, prints the ring slots in input order
+void* pipeline_writer(void* arguments) {
+    OutputRing& ring = *static_cast<PipelineArguments*>(arguments)->ring;
+    std::string out;
+    while (true) {
+        pthread_mutex_lock(&ring.mutex);
+        size_t slot = ring.next % ring.slots.size();
+        while (ring.next < ring.total && !ring.ready[slot]) {
+            pthread_cond_wait(&ring.slot_ready, &ring.mutex);
+        }
+        if (ring.next == ring.total) {
+            pthread_mutex_unlock(&ring.mutex);
+            break;
+        }
+        out.swap(ring.slots[slot]);
+        ring.ready[slot] = 0;
+        ring.next++;
+        pthread_cond_signal(&ring.slot_free);
+        pthread_mutex_unlock(&ring.mutex);
 
-    std::string out = parse(argPtr.i, argPtr.iteration, argPtr.tasks, argPtr.task_intervals);
+        std::cout << out << "\n\n\n";
+    }
+    std::cout << std::flush;
+    return nullptr;
+}
 
-    pthread_mutex_lock(argPtr.mutex2);
-    while(*argPtr.counter!=localIteration)
-    {
-        pthread_cond_wait(argPtr.condition, argPtr.mutex2);
+// Function to stream stdin or the mapped input file through a reader, a pool
+// of analysis workers and an ordered writer, with bounded queues between the
+// stages. A mapped file is scanned as the pipeline goes, its lines are never
+// copied or indexed up front
+int runPipeline() {
+    const char* input_path = options.input_path;
+    MappedFile mapped;
+    if (input_path != nullptr && !mapFile(input_path, mapped)) {
+        std::cerr << "Error mapping " << input_path << std::endl;
+        return 1;
     }
-    pthread_mutex_unlock(argPtr.mutex2);
 
-    std::cout << out << std::endl << std::endl << std::endl;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = cores > 0 ? cores : 1;
+
+    JobQueue queue;
+    pthread_mutex_init(&queue.mutex, nullptr);
+    pthread_cond_init(&queue.not_empty, nullptr);
+    pthread_cond_init(&queue.not_full, nullptr);
+    queue.capacity = 2 * workers;
+
+    OutputRing ring;
+    pthread_mutex_init(&ring.mutex, nullptr);
+    pthread_cond_init(&ring.slot_ready, nullptr);
+    pthread_cond_init(&ring.slot_free, nullptr);
+    ring.slots.resize(4 * workers);
+    ring.ready.assign(ring.slots.size(), 0);
+
+    PipelineArguments args = {&queue, &ring};
+    std::vector<pthread_t> threads(workers + 1);
+    pthread_create(&threads[0], nullptr, pipeline_writer, &args);
+    for (size_t i = 1; i <= workers; ++i) {
+        pthread_create(&threads[i], nullptr, pipeline_worker, &args);
+    }
 
-    pthread_mutex_lock(argPtr.mutex2);
-    (*argPtr.counter)++;
-    pthread_cond_broadcast((argPtr.condition));
-    pthread_mutex_unlock(argPtr.mutex2);
+    // Reader stage
+    std::string input;
+    std::string_view line;
+    size_t position = 0;
+    size_t count = 0;
+    while (input_path != nullptr ? nextLine(mapped.view(), position, line)
+                                 : static_cast<bool>(std::getline(std::cin, input))) {
+        if (input_path == nullptr && input.empty()) {
+            continue;
+        }
+        pthread_mutex_lock(&ring.mutex);
+        while (count - ring.next >= ring.slots.size()) {
+            pthread_cond_wait(&ring.slot_free, &ring.mutex);
+        }
+        pthread_mutex_unlock(&ring.mutex);
 
-    return nullptr;
+        pthread_mutex_lock(&queue.mutex);
+        while (queue.jobs.size() >= queue.capacity) {
+            pthread_cond_wait(&queue.not_full, &queue.mutex);
+        }
+        queue.jobs.push_back({count++, std::move(input), line});
+        pthread_cond_signal(&queue.not_empty);
+        pthread_mutex_unlock(&queue.mutex);
+    }
 
-}
+    pthread_mutex_lock(&queue.mutex);
+    queue.closed = true;
+    pthread_cond_broadcast(&queue.not_empty);
+    pthread_mutex_unlock(&queue.mutex);
 
-// Function to get inputs from user
-std::vector<std::string> get_inputs() {
-    std::vector<std::string> inputs;
-    std::string input;
+    pthread_mutex_lock(&ring.mutex);
+    ring.total = count;
+    pthread_cond_signal(&ring.slot_ready);
+    pthread_mutex_unlock(&ring.mutex);
 
-     while (std::getline(std::cin, input)) {
-         if (!input.empty()) {
-             inputs.push_back(input);
-         }
-     }
-    return inputs;
+    for (auto& thread : threads) {
+        pthread_join(thread, nullptr);
+    }
+    unmapFile(mapped);
+    return 0;
 }
 
-int main() {
-    const std::vector<std::string> inputs = get_inputs();
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        OptionStatus status = readAnalysisOption(argc, argv, i, options);
+        if (status == OptionStatus::Invalid) {
+            return 1;
+        }
+        if (status == OptionStatus::Other && std::string(argv[i]) == "--stream") {
+            stream_pipeline = true;
+        }
+    }
+    if (stream_pipeline) {
+        return runPipeline();
+    }
+    MappedFile mapped;
+    std::vector<std::string> stdin_lines;
+    std::vector<std::string_view> inputs;
+    if (!readLines(options.input_path, mapped, stdin_lines, inputs)) {
+        std::cerr << "Error mapping " << options.input_path << std::endl;
+        return 1;
+    }
 
 
 
@@ -257,14 +292,14 @@ int main() {
     pthread_mutex_t mutex2;
     pthread_mutex_init(&mutex2, nullptr);
 
-    pthread_cond_t condition = PTHREAD_COND_INITIALIZER;
-    static int counter = 0;
+    ReorderBuffer reorder;
+    reorder.slots.resize(inputs.size());
+    reorder.ready.assign(inputs.size(), 0);
 
     Arguments newArg;
-    newArg.counter = &counter;
     newArg.mutex = &mutex;
     newArg.mutex2 = &mutex2;
-    newArg.condition = &condition;
+    newArg.reorder = &reorder;
 
     std::vector<pthread_t> threadVec;
 
@@ -290,5 +325,6 @@ int main() {
         pthread_join(threadVec[i], NULL);
     }
 
+    unmapFile(mapped);
     return 0;
 }
\ No newline at end of file
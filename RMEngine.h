@@ -0,0 +1,1383 @@
+// Rate Monotonic engine shared by HW1, HW3 and HW2Server: the task types,
+// input file mapping, task line parser, hyperperiod arithmetic,
+// schedulability and sensitivity analysis, the diagram simulators and the
+// per-line analysis with its command line options. HW2Client uses it for the
+// types and the parser. Header only, so every program still builds from its
+// single .cpp file
+#ifndef RM_ENGINE_H
+#define RM_ENGINE_H
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Struct to hold task information
+struct Task {
+    char name;
+    unsigned wcet;
+    unsigned period;
+    unsigned initial_wcet; // We need to store initial WCET for reset
+};
+
+// Struct to hold one run of the scheduling diagram
+struct DiagramRun {
+    char name; // 'I' for idle time
+    unsigned length;
+};
+
+// Largest hyperperiod the simulators can represent in a DiagramRun
+const unsigned long long max_hyperperiod = std::numeric_limits<unsigned>::max();
+
+// Longest block of runs CompactDiagram detects repeating back to back
+const size_t max_repeat_runs = 1024;
+
+// Largest task count with a precomputed Liu-Layland threshold
+const size_t max_tabled_tasks = 256;
+
+// Largest task count simulated by a fixed-size specialization
+const size_t max_fixed_tasks = 8;
+
+// Function to calculate the greatest common divisor (GCD) using Euclidean algorithm
+inline unsigned long long gcd(unsigned long long a, unsigned long long b) {
+    while (b != 0) {
+        unsigned long long temp = b;
+        b = a % b;
+        a = temp;
+    }
+    return a;
+}
+
+// Function to calculate the least common multiple (LCM) using GCD, saturating
+// at the largest unsigned long long instead of wrapping around on overflow
+inline unsigned long long lcm(unsigned long long a, unsigned long long b) {
+    unsigned long long result;
+    if (__builtin_mul_overflow(a / gcd(a, b), b, &result)) {
+        return std::numeric_limits<unsigned long long>::max();
+    }
+    return result;
+}
+
+// Function to compare tasks based on their periods
+inline bool compareTasks(const Task& a, const Task& b) {
+    return a.period < b.period;
+}
+
+// Function to sort tasks into priority order, tasks with equal periods keep
+// their input order. Runs of 32 tasks are insertion sorted and then merged
+// through a per-thread buffer, which unlike the one std::stable_sort takes
+// on every call is only allocated until it has grown to fit
+inline void sortByPriority(std::vector<Task>& tasks) {
+    const size_t run = 32;
+    size_t n = tasks.size();
+    for (size_t start = 0; start < n; start += run) {
+        size_t end = std::min(start + run, n);
+        for (size_t i = start + 1; i < end; ++i) {
+            Task task = tasks[i];
+            size_t j = i;
+            for (; j > start && compareTasks(task, tasks[j - 1]); --j) {
+                tasks[j] = tasks[j - 1];
+            }
+            tasks[j] = task;
+        }
+    }
+    if (n <= run) {
+        return;
+    }
+    static thread_local std::vector<Task> buffer;
+    buffer.resize(n);
+    Task* from = tasks.data();
+    Task* to = buffer.data();
+    for (size_t width = run; width < n; width *= 2) {
+        for (size_t left = 0; left < n; left += 2 * width) {
+            size_t middle = std::min(left + width, n);
+            size_t right = std::min(left + 2 * width, n);
+            std::merge(from + left, from + middle, from + middle, from + right, to + left,
+                       compareTasks);
+        }
+        std::swap(from, to);
+    }
+    if (from != tasks.data()) {
+        std::copy(from, from + n, tasks.data());
+    }
+}
+
+// Function to append a value as a LEB128 varint, 7 bits per byte with the
+// high bit set on every byte but the last
+inline void appendVarint(std::string& out, unsigned long long value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+// Function to read a LEB128 varint ending before end and move data past it.
+// Returns false if the varint runs into end or does not fit in 64 bits
+inline bool readVarint(const char*& data, const char* end, unsigned long long& value) {
+    value = 0;
+    for (int shift = 0; data < end && shift < 64; shift += 7) {
+        unsigned char byte = *data++;
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Scheduling diagram kept as a byte stream instead of one struct per run. A
+// run is its task name byte and its length as a varint, two or three bytes
+// for most runs. A 0 byte followed by varints k > 0 and n stands for the last
+// k runs repeated n more times, and followed by k = 0 for a task named '\0'.
+// The bytes hold no pointers or host-order integers, so they can be stored
+// or sent as they are. Runs go in through append(), which detects blocks of
+// up to max_repeat_runs runs repeating back to back and finish() when the
+// diagram is complete
+struct CompactDiagram {
+    std::string bytes;
+    unsigned long long runs = 0; // Runs in the diagram, repeats expanded
+
+    // Encoder state. The last runs packed into one integer each with where
+    // their bytes start if they were written out, and by hash of a run one
+    // plus the index it was last seen at. The distance back to the last
+    // equal run is the candidate block length, kept while the runs after it
+    // go on repeating the ones candidate before them
+    static const size_t history_size = 2 * max_repeat_runs;
+    static const size_t seen_bits = 12;
+    std::array<unsigned long long, history_size> keys;
+    std::array<size_t, history_size> offsets;
+    std::array<unsigned long long, size_t(1) << seen_bits> seen{};
+    size_t candidate = 0;           // Block length being checked, 0 if none
+    size_t streak = 0;              // Runs in a row equal to the run candidate before
+    size_t block = 0;               // Runs in the block being repeated, 0 if none
+    unsigned long long repeats = 0; // Completed repeats of the block
+    size_t pending = 0;             // Runs of the next repeat seen so far
+
+    // Entries of seen left by an earlier diagram are caught by comparing
+    // keys, so clearing does not touch the table
+    void clear() {
+        bytes.clear();
+        runs = 0;
+        candidate = 0;
+        streak = 0;
+        block = 0;
+        repeats = 0;
+        pending = 0;
+    }
+
+    static unsigned long long key(DiagramRun run) {
+        return static_cast<unsigned long long>(static_cast<unsigned char>(run.name)) << 32 |
+               run.length;
+    }
+
+    DiagramRun back(size_t k) const {
+        unsigned long long packed = keys[(runs - k) % history_size];
+        return {static_cast<char>(packed >> 32), static_cast<unsigned>(packed)};
+    }
+
+    unsigned long long& lastSeen(unsigned long long packed) {
+        return seen[packed * 0x9e3779b97f4a7c15ull >> (64 - seen_bits)];
+    }
+
+    void remember(unsigned long long packed, size_t offset) {
+        keys[runs % history_size] = packed;
+        offsets[runs % history_size] = offset;
+        ++runs;
+        lastSeen(packed) = runs;
+    }
+
+    // Function to write one run, built in place so the string grows once
+    void write(DiagramRun run) {
+        char token[8];
+        size_t size = 0;
+        token[size++] = run.name;
+        if (run.name == '\0') {
+            token[size++] = '\0';
+        }
+        unsigned length = run.length;
+        for (; length >= 0x80; length >>= 7) {
+            token[size++] = static_cast<char>(length | 0x80);
+        }
+        token[size++] = static_cast<char>(length);
+        bytes.append(token, size);
+    }
+
+    // The repeat token goes out once the repeat ends, followed by the runs
+    // that matched only part of one more repeat
+    void closeRepeat() {
+        if (block == 1 && repeats == 1) {
+            write(back(1)); // Cheaper than a repeat token
+        } else {
+            bytes += '\0';
+            appendVarint(bytes, block);
+            appendVarint(bytes, repeats);
+        }
+        for (size_t k = pending; k > 0; --k) {
+            offsets[(runs - k) % history_size] = bytes.size();
+            write(back(k));
+        }
+        candidate = 0;
+        streak = 0;
+        block = 0;
+        pending = 0;
+    }
+
+    void append(DiagramRun run) {
+        unsigned long long packed = key(run);
+        if (block > 0) {
+            if (packed == keys[(runs - block) % history_size]) {
+                remember(packed, 0);
+                if (++pending == block) {
+                    ++repeats;
+                    pending = 0;
+                }
+                return;
+            }
+            closeRepeat();
+        }
+
+        size_t offset = bytes.size();
+        write(run);
+        if (candidate > 0 && keys[(runs - candidate) % history_size] == packed) {
+            ++streak;
+        } else {
+            unsigned long long last = lastSeen(packed);
+            bool recent = last > 0 && last <= runs && runs - last < max_repeat_runs;
+            candidate = recent && keys[(last - 1) % history_size] == packed ? runs - last + 1 : 0;
+            streak = 1;
+        }
+        remember(packed, offset);
+        if (candidate > 0 && streak >= candidate) {
+            // The last candidate runs repeat the ones before them, so their
+            // bytes are replaced by a repeat token once the repeat ends
+            bytes.resize(offsets[(runs - candidate) % history_size]);
+            block = candidate;
+            repeats = 1;
+            pending = 0;
+        }
+    }
+
+    void finish() {
+        if (block > 0) {
+            closeRepeat();
+        }
+    }
+};
+
+// Function to call visit(run) for every run of a diagram in order, expanding
+// the repeats as it goes. The bytes may have come over the network, so
+// decoding stops and returns false at a truncated run, a length too large
+// for a run or a repeat reaching back past the runs decoded so far
+template <typename Visit>
+bool forEachRun(const char* data, size_t size, Visit visit) {
+    std::array<DiagramRun, CompactDiagram::history_size> recent;
+    unsigned long long count = 0;
+    const char* end = data + size;
+    while (data < end) {
+        char name = *data++;
+        unsigned long long value;
+        if (!readVarint(data, end, value)) {
+            return false;
+        }
+        if (name == '\0' && value > 0) {
+            unsigned long long block = value;
+            unsigned long long runs;
+            if (block > count || block > recent.size() || !readVarint(data, end, value) ||
+                __builtin_mul_overflow(block, value, &runs)) {
+                return false;
+            }
+            for (unsigned long long i = 0; i < runs; ++i) {
+                DiagramRun run = recent[(count - block) % recent.size()];
+                recent[count++ % recent.size()] = run;
+                visit(run);
+            }
+            continue;
+        }
+        if (name == '\0' && !readVarint(data, end, value)) {
+            return false;
+        }
+        if (value > max_hyperperiod) {
+            return false;
+        }
+        DiagramRun run = {name, static_cast<unsigned>(value)};
+        recent[count++ % recent.size()] = run;
+        visit(run);
+    }
+    return true;
+}
+
+template <typename Visit>
+bool forEachRun(const CompactDiagram& diagram, Visit visit) {
+    return forEachRun(diagram.bytes.data(), diagram.bytes.size(), visit);
+}
+
+// Set of the tasks with work left, by index in priority order. Bit i % 64 of
+// words[i / 64] is set while task i is ready and bit w % 64 of
+// summary[w / 64] while words[w] is not zero, so the highest priority ready
+// task is found with two count trailing zeros for up to 4096 tasks
+struct ReadySet {
+    static const size_t none = static_cast<size_t>(-1);
+    std::vector<unsigned long long> words;
+    std::vector<unsigned long long> summary;
+
+    void reset(size_t count) {
+        words.assign((count + 63) / 64, 0);
+        summary.assign((words.size() + 63) / 64, 0);
+    }
+
+    void insert(size_t i) {
+        words[i / 64] |= 1ull << (i % 64);
+        summary[i / 4096] |= 1ull << (i / 64 % 64);
+    }
+
+    void erase(size_t i) {
+        words[i / 64] &= ~(1ull << (i % 64));
+        if (words[i / 64] == 0) {
+            summary[i / 4096] &= ~(1ull << (i / 64 % 64));
+        }
+    }
+
+    // Index of the highest priority ready task, none if no task is ready
+    size_t first() const {
+        for (size_t s = 0; s < summary.size(); ++s) {
+            if (summary[s] != 0) {
+                size_t word = s * 64 + __builtin_ctzll(summary[s]);
+                return word * 64 + __builtin_ctzll(words[word]);
+            }
+        }
+        return none;
+    }
+};
+
+// Min-heap of the next release time of every task, paired with its index
+struct ReleaseQueue {
+    std::vector<std::pair<unsigned long long, size_t>> heap;
+
+    // Every task is first released at time 0, equal keys already form a heap
+    void reset(size_t count) {
+        heap.clear();
+        for (size_t i = 0; i < count; ++i) {
+            heap.push_back({0, i});
+        }
+    }
+
+    unsigned long long next() const {
+        return heap.empty() ? std::numeric_limits<unsigned long long>::max() : heap.front().first;
+    }
+
+    // Function to release every job arriving at time, resetting its WCET and
+    // marking it ready. Costs O(log n) per job released rather than a pass
+    // over every task, returns if any job was released
+    bool release(unsigned long long time, std::vector<Task>& tasks, ReadySet& ready) {
+        bool released = false;
+        while (next() == time) {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+            size_t i = heap.back().second;
+            tasks[i].wcet = tasks[i].initial_wcet; // Reset WCET
+            if (tasks[i].wcet > 0) {
+                ready.insert(i);
+            }
+            heap.back().first += tasks[i].period;
+            std::push_heap(heap.begin(), heap.end(), std::greater<>());
+            released = true;
+        }
+        return released;
+    }
+};
+
+// State of the simulators for task sets too large for simulateEventsFixed,
+// kept in the Workspace so its buffers are reused
+struct Scheduler {
+    ReadySet ready;
+    ReleaseQueue releases;
+
+    void reset(size_t count) {
+        ready.reset(count);
+        releases.reset(count);
+    }
+};
+
+// Per-worker storage reused from one task set to the next. Once its buffers
+// have grown to fit the largest task set seen, an analysis allocates nothing
+struct Workspace {
+    std::vector<Task> tasks;
+    CompactDiagram diagram;
+    Scheduler scheduler;
+    std::vector<unsigned long long> response_times;
+    std::string output;
+};
+
+// Struct to hold where a task line stopped parsing and why
+struct ParseError {
+    size_t position;     // Offset into the line
+    const char* message; // nullptr if the line was well formed
+};
+
+// Function to check for the whitespace that separates the fields of a task line
+inline bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Function to skip the whitespace at position
+inline void skipSeparators(std::string_view input, size_t& position) {
+    while (position < input.size() && isSeparator(input[position])) {
+        ++position;
+    }
+}
+
+// Function to parse the unsigned field at position, which must be followed by
+// whitespace or the end of the line
+inline bool parseField(std::string_view input, size_t& position, unsigned& value,
+                       const char* missing, ParseError& error) {
+    skipSeparators(input, position);
+    if (position == input.size()) {
+        error = {position, missing};
+        return false;
+    }
+    const char* first = input.data() + position;
+    const char* last = input.data() + input.size();
+    std::from_chars_result parsed = std::from_chars(first, last, value);
+    if (parsed.ec == std::errc::result_out_of_range) {
+        error = {position, "number out of range"};
+        return false;
+    }
+    if (parsed.ec != std::errc()) {
+        error = {position, "expected a number"};
+        return false;
+    }
+    position = parsed.ptr - input.data();
+    if (position < input.size() && !isSeparator(input[position])) {
+        error = {position, "expected whitespace after number"};
+        return false;
+    }
+    return true;
+}
+
+// Function to parse the next "name wcet period" triple of a task line into
+// task. Returns false at the end of the line, with error.message set if the
+// line is malformed there
+inline bool nextTask(std::string_view input, size_t& position, Task& task, ParseError& error) {
+    error = {position, nullptr};
+    skipSeparators(input, position);
+    if (position == input.size()) {
+        return false;
+    }
+    task.name = input[position++];
+    if (position < input.size() && !isSeparator(input[position])) {
+        error = {position, "expected whitespace after task name"};
+        return false;
+    }
+    if (!parseField(input, position, task.wcet, "missing WCET", error)) {
+        return false;
+    }
+    size_t period_position = position;
+    if (!parseField(input, position, task.period, "missing period", error)) {
+        return false;
+    }
+    if (task.period == 0) {
+        skipSeparators(input, period_position);
+        error = {period_position, "period must be positive"};
+        return false;
+    }
+    task.initial_wcet = task.wcet;
+    return true;
+}
+
+// Function to parse a task line and append its tasks. On malformed input the
+// tasks before the error are kept and false is returned
+inline bool parseTasks(std::string_view input, std::vector<Task>& tasks, ParseError& error) {
+    size_t position = 0;
+    Task task;
+    while (nextTask(input, position, task, error)) {
+        tasks.push_back(task);
+    }
+    return error.message == nullptr;
+}
+
+// Function to describe a parse error, where names the line such as "CPU 3"
+inline std::string parseErrorText(const std::string& where, const ParseError& error) {
+    return "Malformed input for " + where + " at column " + std::to_string(error.position + 1) +
+           ": " + error.message + "\n";
+}
+
+// Function to append a number to out without going through iostreams
+inline void appendNumber(std::string& out, unsigned long long value) {
+    char digits[20];
+    out.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+}
+
+// Function to append a value with two decimals, as std::fixed with
+// std::setprecision(2) would print it, or with the given precision
+inline void appendFixed(std::string& out, double value, int precision = 2) {
+    char digits[400]; // Room for any double in fixed notation
+    out.append(digits, std::to_chars(digits, digits + sizeof(digits), value,
+                                     std::chars_format::fixed, precision).ptr);
+}
+
+// Function to output the task list, utilization and hyperperiod of one CPU
+inline void outputInfo(std::string& out, const std::vector<Task>& tasks, size_t iteration,
+                       unsigned long long hyperperiod, double utilization) {
+    out += "CPU ";
+    appendNumber(out, iteration);
+    out += "\nTask scheduling information: ";
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        out += tasks[i].name;
+        out += " (WCET: ";
+        appendNumber(out, tasks[i].wcet);
+        out += ", Period: ";
+        appendNumber(out, tasks[i].period);
+        out += ')';
+        if (i < tasks.size() - 1) {
+            out += ", ";
+        }
+    }
+    out += "\nTask set utilization: ";
+    appendFixed(out, utilization);
+    out += "\nHyperperiod: ";
+    if (hyperperiod > max_hyperperiod) {
+        out += "too large";
+    } else {
+        appendNumber(out, hyperperiod);
+    }
+}
+
+// Function to output the scheduling diagram of one CPU, rendered straight
+// from its compact form
+inline void appendDiagram(std::string& out, const CompactDiagram& diagram, size_t iteration) {
+    out += "Scheduling Diagram for CPU ";
+    appendNumber(out, iteration);
+    out += ": ";
+    char last_task = ' ';
+    forEachRun(diagram, [&](const DiagramRun& run) {
+        if (run.name != 'I') {
+            out += run.name;
+            last_task = run.name;
+        } else if (last_task != 'I') {
+            out += "Idle";
+            last_task = 'I';
+        } else {
+            return;
+        }
+        out += '(';
+        appendNumber(out, run.length);
+        out += "), ";
+    });
+    // Remove trailing comma and space
+    if (diagram.runs > 0) {
+        out.resize(out.size() - 2);
+    }
+}
+
+// Function to get the Liu-Layland threshold n * (2^(1/n) - 1), looked up in a
+// table built once instead of calling std::pow for every task set
+inline double liuLaylandThreshold(size_t n) {
+    static const std::vector<double> thresholds = [] {
+        std::vector<double> table(max_tabled_tasks + 1);
+        for (size_t i = 0; i <= max_tabled_tasks; ++i) {
+            table[i] = i * (std::pow(2.0, 1.0 / i) - 1);
+        }
+        return table;
+    }();
+    if (n <= max_tabled_tasks) {
+        return thresholds[n];
+    }
+    return n * (std::pow(2.0, 1.0 / n) - 1);
+}
+
+// Builds the scheduling diagram by keeping the last run open until a
+// different run starts, so extending a run or merging idle time costs the
+// same at any diagram length. Closed runs go to the diagram's encoder
+struct IntervalBuilder {
+    CompactDiagram& diagram;
+    unsigned long long from; // Time before which nothing is recorded
+    bool open = false;       // A run is being extended
+    DiagramRun last;
+    unsigned last_end;
+    bool stopped = false; // A job release ended the last run
+
+    IntervalBuilder(CompactDiagram& out, unsigned long long start = 0)
+        : diagram(out), from(start) {}
+
+    // A job release ends the current run, the next tick starts a new run
+    void release() { stopped = true; }
+
+    void openRun(char name, unsigned start, unsigned end) {
+        if (open) {
+            diagram.append(last);
+        }
+        open = true;
+        last = {name, end - start};
+        last_end = end;
+        stopped = false;
+    }
+
+    // Task ran during [start, end)
+    void run(char name, unsigned start, unsigned end) {
+        if (end <= from) {
+            return;
+        }
+        start = std::max<unsigned long long>(start, from);
+        if (open && last.name == name && !stopped && last_end == start) {
+            last.length += end - start; // Extend run
+            last_end = end;
+            return;
+        }
+        openRun(name, start, end);
+    }
+
+    // Processor was idle during [start, end), adjacent idle time is merged
+    void idle(unsigned start, unsigned end) {
+        if (end <= from) {
+            return;
+        }
+        start = std::max<unsigned long long>(start, from);
+        if (open && last.name == 'I') {
+            last.length += end - last_end;
+            last_end = end;
+            return;
+        }
+        openRun('I', start, end);
+    }
+
+    // Simulation reached its limit, write out the open run
+    void finish() {
+        if (open) {
+            diagram.append(last);
+            open = false;
+        }
+        diagram.finish();
+    }
+};
+
+// Function to generate the scheduling diagram by visiting every tick before limit
+inline void simulateTicks(std::vector<Task>& tasks, unsigned long long limit,
+                          IntervalBuilder& builder, Scheduler& scheduler) {
+    ReadySet& ready = scheduler.ready;
+    scheduler.reset(tasks.size());
+    for (unsigned tick = 0; tick < limit; ++tick) {
+        if (scheduler.releases.release(tick, tasks, ready)) {
+            builder.release();
+        }
+        size_t running = ready.first();
+        if (running != ReadySet::none) {
+            builder.run(tasks[running].name, tick, tick + 1);
+            if (--tasks[running].wcet == 0) {
+                ready.erase(running);
+            }
+        } else {
+            // No task is running at this time, insert idle interval
+            builder.idle(tick, tick + 1);
+        }
+    }
+    builder.finish();
+}
+
+// Event-driven simulation of exactly N tasks. The task state lives in
+// fixed-size arrays the compiler can keep in registers, and the release
+// checks and priority selection are unrolled into branch-free selects
+template <size_t N>
+void simulateEventsFixed(std::vector<Task>& tasks, unsigned long long limit,
+                         IntervalBuilder& builder) {
+    std::array<unsigned long long, N> next_release{};
+    std::array<unsigned, N> remaining;
+    std::array<unsigned, N> wcet;
+    std::array<unsigned, N> period;
+#pragma GCC unroll 8
+    for (size_t i = 0; i < N; ++i) {
+        remaining[i] = tasks[i].wcet;
+        wcet[i] = tasks[i].initial_wcet;
+        period[i] = tasks[i].period;
+    }
+
+    unsigned long long time = 0;
+    while (time < limit) {
+        // Release the jobs arriving now and find when the next one arrives
+        unsigned long long next_event = limit;
+        bool released = false;
+#pragma GCC unroll 8
+        for (size_t i = 0; i < N; ++i) {
+            bool arrives = next_release[i] == time;
+            remaining[i] = arrives ? wcet[i] : remaining[i];
+            next_release[i] += arrives ? period[i] : 0;
+            released |= arrives;
+            next_event = std::min(next_event, next_release[i]);
+        }
+        if (released) {
+            builder.release();
+        }
+
+        // The highest priority task with work left runs
+        size_t running = N;
+#pragma GCC unroll 8
+        for (size_t k = 1; k <= N; ++k) {
+            running = remaining[N - k] > 0 ? N - k : running;
+        }
+
+        if (running == N) {
+            // Nothing is ready, stay idle until the next release
+            builder.idle(time, next_event);
+            time = next_event;
+        } else {
+            // Run until the job finishes or the next release may preempt it
+            unsigned long long end = next_event;
+            if (remaining[running] < next_event - time) {
+                end = time + remaining[running];
+            }
+            builder.run(tasks[running].name, time, end);
+            remaining[running] -= end - time;
+            time = end;
+        }
+    }
+
+    for (size_t i = 0; i < N; ++i) {
+        tasks[i].wcet = remaining[i];
+    }
+    builder.finish();
+}
+
+// Function to generate the scheduling diagram by jumping from one event (a job
+// release or the running job finishing) to the next instead of visiting every
+// tick. Task sets of up to max_fixed_tasks tasks use simulateEventsFixed
+inline void simulateEvents(std::vector<Task>& tasks, unsigned long long limit,
+                           IntervalBuilder& builder, Scheduler& scheduler) {
+    switch (tasks.size()) {
+    case 1: simulateEventsFixed<1>(tasks, limit, builder); return;
+    case 2: simulateEventsFixed<2>(tasks, limit, builder); return;
+    case 3: simulateEventsFixed<3>(tasks, limit, builder); return;
+    case 4: simulateEventsFixed<4>(tasks, limit, builder); return;
+    case 5: simulateEventsFixed<5>(tasks, limit, builder); return;
+    case 6: simulateEventsFixed<6>(tasks, limit, builder); return;
+    case 7: simulateEventsFixed<7>(tasks, limit, builder); return;
+    case 8: simulateEventsFixed<8>(tasks, limit, builder); return;
+    }
+
+    // Larger sets keep the ready tasks in a bitmap and the releases in a
+    // heap, so a scheduling decision costs the same at any task count
+    ReadySet& ready = scheduler.ready;
+    scheduler.reset(tasks.size());
+    unsigned long long time = 0;
+    while (time < limit) {
+        // Release the jobs arriving now and find when the next one arrives
+        if (scheduler.releases.release(time, tasks, ready)) {
+            builder.release();
+        }
+        unsigned long long next_event = std::min(limit, scheduler.releases.next());
+
+        // The highest priority task with work left runs
+        size_t running = ready.first();
+        if (running == ReadySet::none) {
+            // Nothing is ready, stay idle until the next release
+            builder.idle(time, next_event);
+            time = next_event;
+        } else {
+            // Run until the job finishes or the next release may preempt it
+            Task& task = tasks[running];
+            unsigned long long end = next_event;
+            if (task.wcet < next_event - time) {
+                end = time + task.wcet;
+            }
+            builder.run(task.name, time, end);
+            task.wcet -= end - time;
+            if (task.wcet == 0) {
+                ready.erase(running);
+            }
+            time = end;
+        }
+    }
+    builder.finish();
+}
+
+// Function to check the hyperbolic bound: the task set is schedulable if the
+// product of (U_i + 1) over all tasks is at most 2
+inline bool hyperbolicBound(const std::vector<Task>& tasks) {
+    double product = 1.0;
+    for (const auto& task : tasks) {
+        product *= static_cast<double>(task.initial_wcet) / task.period + 1.0;
+    }
+    return product <= 2.0;
+}
+
+// Function to calculate the worst-case response time of tasks[i] with exact
+// response-time analysis, tasks must already be sorted by priority. The
+// iteration starts from seed, which must not exceed the response time, and
+// stops once the response time exceeds the period
+inline unsigned long long responseTime(const std::vector<Task>& tasks, size_t i,
+                                       unsigned long long seed) {
+    // R = C_i + sum over higher priority tasks of ceil(R / T_j) * C_j
+    unsigned long long response = seed;
+    while (response <= tasks[i].period) {
+        unsigned long long next = tasks[i].initial_wcet;
+        for (size_t j = 0; j < i; ++j) {
+            next += (response + tasks[j].period - 1) / tasks[j].period * tasks[j].initial_wcet;
+        }
+        if (next == response) {
+            break;
+        }
+        response = next;
+    }
+    return response;
+}
+
+// Function to calculate the worst-case response time of every task with exact
+// response-time analysis, tasks must already be sorted by priority.
+// Returns false if some task can miss its deadline
+inline bool responseTimes(const std::vector<Task>& tasks,
+                          std::vector<unsigned long long>& response_times) {
+    bool schedulable = true;
+    unsigned long long busy = 0; // Sum of the WCETs up to task i, the first guess
+    response_times.assign(tasks.size(), 0);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        busy += tasks[i].initial_wcet;
+        response_times[i] = responseTime(tasks, i, busy);
+        if (response_times[i] > tasks[i].period) {
+            schedulable = false;
+        }
+    }
+    return schedulable;
+}
+
+// Function to find how far the WCET of tasks[i] can grow with the task set
+// staying schedulable, by binary search over exact response-time analysis
+// of the tasks it can delay. response_times must hold the response times of
+// the schedulable set. Growing a WCET by d delays every task from i on by at
+// least d, which bounds the search, and the response times at the largest
+// growth known to fit, kept in floors, seed each analysis so it starts close
+// to the answer. The task that failed last is checked first, trial holds the
+// response times of the growth being tried
+inline unsigned long long wcetSlack(std::vector<Task>& tasks, size_t i,
+                                    const std::vector<unsigned long long>& response_times,
+                                    std::vector<unsigned long long>& floors,
+                                    std::vector<unsigned long long>& trial) {
+    unsigned long long low = 0;
+    unsigned long long high = tasks[i].period - response_times[i];
+    for (size_t j = i + 1; j < tasks.size(); ++j) {
+        high = std::min(high, tasks[j].period - response_times[j]);
+    }
+    floors.assign(response_times.begin(), response_times.end());
+    trial.resize(tasks.size());
+    unsigned wcet = tasks[i].initial_wcet;
+    size_t failed = i;
+    while (low < high) {
+        unsigned long long middle = low + (high - low + 1) / 2;
+        unsigned long long growth = middle - low;
+        tasks[i].initial_wcet = wcet + middle;
+        trial[failed] = responseTime(tasks, failed, floors[failed] + growth);
+        bool fits = trial[failed] <= tasks[failed].period;
+        for (size_t j = i; fits && j < tasks.size(); ++j) {
+            if (j != failed) {
+                trial[j] = responseTime(tasks, j, floors[j] + growth);
+                fits = trial[j] <= tasks[j].period;
+                failed = fits ? failed : j;
+            }
+        }
+        if (fits) {
+            floors.swap(trial);
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    tasks[i].initial_wcet = wcet;
+    return low;
+}
+
+// Function to check the task set with every WCET multiplied by factor using
+// response-time analysis, tasks must already be sorted by priority
+inline bool scaledSchedulable(const std::vector<Task>& tasks, double factor) {
+    double busy = 0; // Sum of the scaled WCETs up to task i, the first guess
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        busy += factor * tasks[i].initial_wcet;
+        double response = busy;
+        while (true) {
+            double next = factor * tasks[i].initial_wcet;
+            for (size_t j = 0; j < i; ++j) {
+                next += std::ceil(response / tasks[j].period) * factor * tasks[j].initial_wcet;
+            }
+            if (next > tasks[i].period) {
+                return false;
+            }
+            if (next <= response) {
+                break;
+            }
+            response = next;
+        }
+    }
+    return true;
+}
+
+// Function to find the critical scaling factor, the largest factor every
+// WCET can be multiplied by with the task set staying schedulable. Below 1
+// it is how far the WCETs must shrink. The Liu-Layland bound gives a factor
+// that always fits and full utilization one that never fits past, the
+// binary search between them runs until the factor is known to 1e-12
+inline double criticalScalingFactor(const std::vector<Task>& tasks) {
+    double utilization = 0.0;
+    for (const auto& task : tasks) {
+        utilization += static_cast<double>(task.initial_wcet) / task.period;
+    }
+    if (utilization == 0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    double low = liuLaylandThreshold(tasks.size()) / utilization;
+    double high = 1 / utilization;
+    if (scaledSchedulable(tasks, high)) {
+        return high;
+    }
+    if (!scaledSchedulable(tasks, low)) {
+        low = 0; // Only through rounding at the bound
+    }
+    while (high - low > 1e-12 * high) {
+        double middle = low + (high - low) / 2;
+        if (scaledSchedulable(tasks, middle)) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Smallest task set whose WCET slacks are spread over threads, below it the
+// analysis takes less time than starting the threads
+const size_t min_parallel_slack_tasks = 32;
+
+// Set on a thread that shares the lines of an input with other threads
+// already, its WCET slacks stay on it so the cores are not oversubscribed
+inline thread_local bool analysis_worker = false;
+
+// Struct to hold arguments for the pthread function computing WCET slacks
+struct SlackArguments {
+    std::vector<Task> tasks; // Own copy, wcetSlack changes WCETs as it searches
+    const std::vector<unsigned long long>* response_times;
+    std::vector<unsigned long long>* slacks;
+    size_t first;
+    size_t stride;
+};
+
+// Function to compute the WCET slack of every stride-th task from first
+inline void* slackFunction(void* arguments) {
+    SlackArguments* args = static_cast<SlackArguments*>(arguments);
+    std::vector<unsigned long long> floors;
+    std::vector<unsigned long long> trial;
+    for (size_t i = args->first; i < args->tasks.size(); i += args->stride) {
+        (*args->slacks)[i] = wcetSlack(args->tasks, i, *args->response_times, floors, trial);
+    }
+    return nullptr;
+}
+
+// Function to compute the WCET slack of every task, each one independent of
+// the others so large task sets are split over one thread per core. Tasks
+// are dealt out in turn because the higher priority ones cost the most. A
+// share whose thread cannot be started is computed on the calling thread
+inline void wcetSlacks(const std::vector<Task>& tasks,
+                       const std::vector<unsigned long long>& response_times,
+                       std::vector<unsigned long long>& slacks) {
+    slacks.assign(tasks.size(), 0);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = 1;
+    if (tasks.size() >= min_parallel_slack_tasks && cores > 1 && !analysis_worker) {
+        workers = std::min(static_cast<size_t>(cores), tasks.size());
+    }
+    std::vector<SlackArguments> arg_objects(workers);
+    std::vector<pthread_t> threads(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        arg_objects[i] = {tasks, &response_times, &slacks, i, workers};
+    }
+    std::vector<bool> started(workers, false);
+    for (size_t i = 1; i < workers; ++i) {
+        started[i] = pthread_create(&threads[i], nullptr, slackFunction, &arg_objects[i]) == 0;
+    }
+    slackFunction(&arg_objects[0]); // The calling thread takes the first share
+    for (size_t i = 1; i < workers; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], nullptr);
+        } else {
+            slackFunction(&arg_objects[i]);
+        }
+    }
+}
+
+// Function to output the WCET slack of every task and the critical scaling
+// factor, tasks must already be sorted by priority. The factor is cut, not
+// rounded, to four decimals so it never claims more room than there is. The
+// search ends just below the exact factor, the tolerance keeps a factor such
+// as 1.25 from printing as 1.2499
+inline void appendSensitivity(std::string& out, const std::vector<Task>& tasks,
+                              std::vector<unsigned long long>& response_times) {
+    out += "\nWCET slack: ";
+    if (!responseTimes(tasks, response_times)) {
+        out += "none, a deadline can already be missed";
+    } else {
+        std::vector<unsigned long long> slacks;
+        wcetSlacks(tasks, response_times, slacks);
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            out += tasks[i].name;
+            out += " (+";
+            appendNumber(out, slacks[i]);
+            out += ')';
+            if (i < tasks.size() - 1) {
+                out += ", ";
+            }
+        }
+    }
+    out += "\nCritical scaling factor: ";
+    double factor = criticalScalingFactor(tasks);
+    if (std::isinf(factor)) {
+        out += "unbounded";
+    } else {
+        appendFixed(out, std::floor(factor * 1e4 + 1e-6) / 1e4, 4);
+    }
+}
+
+// Function to parse a simulation window given as "END" or "START:END"
+inline bool parseWindow(const std::string& text, unsigned long long& start,
+                        unsigned long long& end) {
+    std::stringstream window_string(text);
+    char separator;
+    start = 0;
+    if (!(window_string >> end)) {
+        return false;
+    }
+    if (window_string >> separator) {
+        start = end;
+        if (separator != ':' || !(window_string >> end)) {
+            return false;
+        }
+    }
+    return start < end && end <= max_hyperperiod;
+}
+
+// Struct to hold the command line options of the line analysis
+struct AnalysisOptions {
+    // Selects the original tick-by-tick simulation instead of the event-driven one
+    bool per_tick_simulation = false;
+
+    // Reports "schedulability is unknown" above the Liu-Layland bound instead of
+    // resolving it with response-time analysis
+    bool liu_layland_only = false;
+
+    // Prints the worst-case response time of every task
+    bool show_response_times = false;
+
+    // Prints how far each WCET can grow and the critical scaling factor
+    bool show_sensitivity = false;
+
+    // Skips the hyperperiod simulation when only the verdict is needed
+    bool skip_diagram = false;
+
+    // Simulation window [window_start, window_end), by default the whole hyperperiod
+    unsigned long long window_start = 0;
+    unsigned long long window_end = max_hyperperiod;
+
+    // File to memory-map and read the task sets from instead of stdin
+    const char* input_path = nullptr;
+};
+
+// Outcome of reading a command line argument as an AnalysisOptions option
+enum class OptionStatus { Other, Read, Invalid };
+
+// Function to read argv[i] into options if it is one of theirs, moving i past
+// its value. An invalid value is reported on stderr
+inline OptionStatus readAnalysisOption(int argc, char* argv[], int& i,
+                                       AnalysisOptions& options) {
+    std::string arg = argv[i];
+    if (arg == "--per-tick") {
+        options.per_tick_simulation = true;
+    } else if (arg == "--liu-layland") {
+        options.liu_layland_only = true;
+    } else if (arg == "--response-times") {
+        options.show_response_times = true;
+    } else if (arg == "--sensitivity") {
+        options.show_sensitivity = true;
+    } else if (arg == "--no-diagram") {
+        options.skip_diagram = true;
+    } else if (arg == "--window") {
+        if (i + 1 >= argc || !parseWindow(argv[++i], options.window_start, options.window_end)) {
+            std::cerr << "--window expects END or START:END" << std::endl;
+            return OptionStatus::Invalid;
+        }
+    } else if (arg == "--input") {
+        if (i + 1 >= argc) {
+            std::cerr << "--input expects a file" << std::endl;
+            return OptionStatus::Invalid;
+        }
+        options.input_path = argv[++i];
+    } else {
+        return OptionStatus::Other;
+    }
+    return OptionStatus::Read;
+}
+
+// Verdict of the schedulability analysis of one task set
+enum class Verdict { Schedulable, NotSchedulable, Unknown, HyperperiodTooLarge };
+
+// Function to check whether a hyperperiod is too large to simulate without a
+// window
+inline bool needsWindow(unsigned long long hyperperiod, const AnalysisOptions& options) {
+    return hyperperiod > max_hyperperiod && options.window_end == max_hyperperiod;
+}
+
+// Function to check whether the utilization of a task set exceeds 1. A sum of
+// doubles can land on either side of 1 depending on the order of the tasks,
+// so the shares are added exactly as a fraction over the hyperperiod of the
+// tasks so far. Only when that no longer fits in 64 bits is the rounded sum
+// in the order of tasks used
+inline bool overloaded(const std::vector<Task>& tasks) {
+    unsigned __int128 numerator = 0;
+    unsigned long long denominator = 1;
+    for (const auto& task : tasks) {
+        unsigned long long common = gcd(denominator, task.period);
+        unsigned long long scale = task.period / common;
+        unsigned long long next;
+        if (__builtin_mul_overflow(denominator, scale, &next)) {
+            double utilization = 0.0;
+            for (const auto& t : tasks) {
+                utilization += static_cast<double>(t.initial_wcet) / t.period;
+            }
+            return utilization > 1;
+        }
+        // The numerator is at most the denominator here, so neither product
+        // exceeds 96 bits
+        numerator = numerator * scale +
+                    static_cast<unsigned __int128>(task.initial_wcet) * (denominator / common);
+        denominator = next;
+        if (numerator > denominator) {
+            return true; // Shares are never negative
+        }
+    }
+    return false;
+}
+
+// Function to decide whether a task set sorted by priority is schedulable and
+// its diagram can be simulated. The Liu-Layland and hyperbolic bounds are
+// cheap sufficient tests and response-time analysis decides the rest exactly.
+// The verdict only depends on the tasks in priority order, never on the
+// order they were given in
+inline Verdict decide(const std::vector<Task>& tasks, unsigned long long hyperperiod,
+                      const AnalysisOptions& options,
+                      std::vector<unsigned long long>& response_times) {
+    double utilization = 0.0;
+    for (const auto& task : tasks) {
+        utilization += static_cast<double>(task.initial_wcet) / task.period;
+    }
+    double threshold = liuLaylandThreshold(tasks.size());
+    bool below_bound = utilization <= threshold && utilization >= 0;
+    if (overloaded(tasks)) {
+        return Verdict::NotSchedulable;
+    }
+    if (options.liu_layland_only && !below_bound) {
+        return Verdict::Unknown;
+    }
+    if (!below_bound && !hyperbolicBound(tasks) && !responseTimes(tasks, response_times)) {
+        return Verdict::NotSchedulable; // A deadline can be missed
+    }
+    if (needsWindow(hyperperiod, options)) {
+        return Verdict::HyperperiodTooLarge;
+    }
+    return Verdict::Schedulable;
+}
+
+// Function to simulate a task set sorted by priority over the window of its
+// hyperperiod given by options, into workspace.diagram
+inline void simulateWindow(std::vector<Task>& tasks, unsigned long long hyperperiod,
+                           const AnalysisOptions& options, Workspace& workspace) {
+    unsigned long long limit = std::min(hyperperiod, options.window_end);
+    workspace.diagram.clear();
+    IntervalBuilder builder(workspace.diagram, options.window_start);
+    if (options.per_tick_simulation) {
+        simulateTicks(tasks, limit, builder, workspace.scheduler);
+    } else {
+        simulateEvents(tasks, limit, builder, workspace.scheduler);
+    }
+}
+
+// Function to parse input and calculate hyperperiod, utilization, and generate
+// scheduling diagram into workspace.output
+inline void analyzeLine(std::string_view input, size_t iteration,
+                        const AnalysisOptions& options, Workspace& workspace) {
+    std::vector<Task>& tasks = workspace.tasks;
+    std::string& output = workspace.output;
+
+    // Parse input string, a malformed line is analyzed up to the error
+    tasks.clear();
+    ParseError error;
+    if (!parseTasks(input, tasks, error)) {
+        std::cerr << parseErrorText("CPU " + std::to_string(iteration), error);
+    }
+
+    // Calculate hyperperiod
+    unsigned long long hyperperiod = 1;
+    for (const auto& task : tasks) {
+        hyperperiod = lcm(hyperperiod, task.period);
+    }
+
+    // Calculate utilization
+    double utilization = 0.0;
+    for (const auto& task : tasks) {
+        utilization += static_cast<double>(task.wcet) / task.period;
+    }
+
+    // Output task scheduling information
+    output.clear();
+    outputInfo(output, tasks, iteration, hyperperiod, utilization);
+
+    // Sort tasks based on their periods
+    sortByPriority(tasks);
+
+    // Calculate worst-case response times
+    std::vector<unsigned long long>& response_times = workspace.response_times;
+    if (options.show_response_times) {
+        responseTimes(tasks, response_times);
+        output += "\nWorst-case response times: ";
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            output += tasks[i].name;
+            output += " (";
+            appendNumber(output, response_times[i]);
+            output += ')';
+            if (i < tasks.size() - 1) {
+                output += ", ";
+            }
+        }
+    }
+
+    // Capacity planning: WCET slack and critical scaling factor
+    if (options.show_sensitivity) {
+        appendSensitivity(output, tasks, response_times);
+    }
+
+    // Check schedulability
+    Verdict verdict = decide(tasks, hyperperiod, options, response_times);
+    output += "\nRate Monotonic Algorithm execution for CPU";
+    appendNumber(output, iteration);
+    output += ':';
+    if (verdict == Verdict::NotSchedulable) {
+        output += "\nThe task set is not schedulable";
+    } else if (verdict == Verdict::Unknown) {
+        output += "\nTask set schedulability is unknown";
+    } else if (verdict == Verdict::HyperperiodTooLarge) {
+        output += "\nHyperperiod too large to simulate, use --window";
+    } else if (options.skip_diagram) {
+        output += "\nThe task set is schedulable";
+    } else {
+        // Generate scheduling diagram, limited to the simulation window
+        simulateWindow(tasks, hyperperiod, options, workspace);
+        output += '\n';
+        appendDiagram(output, workspace.diagram, iteration);
+    }
+}
+
+// Struct to hold an input file mapped read-only into memory
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    std::string_view view() const { return std::string_view(data, size); }
+};
+
+// Function to map a regular file for reading front to back. The readahead
+// hints let the kernel stream the file in ahead of the line scan, so lines
+// are read straight from the page cache without being copied
+inline bool mapFile(const char* path, MappedFile& file) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) < 0 || !S_ISREG(status.st_mode)) {
+        close(fd);
+        return false;
+    }
+    file.size = status.st_size;
+    if (file.size > 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        void* data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(data, file.size, MADV_SEQUENTIAL);
+        file.data = static_cast<const char*>(data);
+    }
+    close(fd);
+    return true;
+}
+
+// Function to unmap a file mapped by mapFile
+inline void unmapFile(MappedFile& file) {
+    if (file.data != nullptr) {
+        munmap(const_cast<char*>(file.data), file.size);
+    }
+    file = MappedFile();
+}
+
+// Function to find the next line of data at or after position, skipping
+// empty lines as the stdin readers do. Returns false at the end of data
+inline bool nextLine(std::string_view data, size_t& position, std::string_view& line) {
+    while (position < data.size()) {
+        const char* start = data.data() + position;
+        const char* newline =
+            static_cast<const char*>(memchr(start, '\n', data.size() - position));
+        size_t length = newline != nullptr ? newline - start : data.size() - position;
+        position += length + 1;
+        if (length > 0) {
+            line = std::string_view(start, length);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to split data into its non-empty lines without copying them
+inline void splitLines(std::string_view data, std::vector<std::string_view>& lines) {
+    size_t position = 0;
+    std::string_view line;
+    while (nextLine(data, position, line)) {
+        lines.push_back(line);
+    }
+}
+
+// Function to get the non-empty lines of stdin
+inline std::vector<std::string> readInputs() {
+    std::vector<std::string> inputs;
+    std::string input;
+    while (std::getline(std::cin, input)) {
+        if (!input.empty()) {
+            inputs.push_back(input);
+        }
+    }
+    return inputs;
+}
+
+// Function to get the input lines as views, into the file at path mapped into
+// mapped if one was given and otherwise into storage filled from stdin.
+// Returns false if the file cannot be mapped
+inline bool readLines(const char* path, MappedFile& mapped,
+                      std::vector<std::string>& storage,
+                      std::vector<std::string_view>& lines) {
+    if (path == nullptr) {
+        storage = readInputs();
+        lines.assign(storage.begin(), storage.end());
+        return true;
+    }
+    if (!mapFile(path, mapped)) {
+        return false;
+    }
+    splitLines(mapped.view(), lines);
+    return true;
+}
+
+#endif
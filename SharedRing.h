@@ -0,0 +1,306 @@
+// Local transports shared by HW2Server and HW2Client. A server also listens
+// on an AF_UNIX socket next to its TCP port, in a directory only its user can
+// enter, and both ends check with SO_PEERCRED that the other one runs as the
+// same user before trusting the socket. A client on the same host
+// can move its connection onto a pair of byte rings in POSIX shared memory:
+// requests flow through one ring and replies through the other, in the same
+// frames as on the socket, without passing through the kernel. Each ring has
+// one producer and one consumer. A side that finds its ring empty or full
+// sleeps on a futex word in the shared memory, and the other side only makes
+// the wake-up call when someone announced they are sleeping. The peer can
+// write anything into the shared memory, so each side keeps its own cursor
+// privately and checks the peer's cursor before every copy. Header only,
+// like RMEngine.h
+#ifndef SHARED_RING_H
+#define SHARED_RING_H
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Bytes of each ring, pages are only touched as the rings fill
+const size_t ring_capacity = 1 << 22;
+
+// How long a side sleeps on a ring before checking that its peer is still
+// connected, so a crashed client does not leave a server process waiting
+const long ring_timeout_ns = 100000000;
+
+// One end of a ring: the bytes moved through it so far, a futex word bumped
+// after every move and the number of peers sleeping on that word. The ends
+// sit on separate cache lines since different processes write them
+struct alignas(64) RingCursor {
+  uint64_t position;
+  uint32_t changes;
+  uint32_t sleepers;
+};
+
+struct RingHeader {
+  RingCursor head; // Advanced by the producer
+  RingCursor tail; // Advanced by the consumer
+  uint32_t closed; // The producer will write no more
+};
+
+// Struct to hold one ring of a mapping, as seen by its producer or by its
+// consumer. The side's own cursor is kept here and only published to the
+// header, and corrupt is set once the peer's cursor was found impossible
+struct SharedRing {
+  RingHeader *header = nullptr;
+  char *data = nullptr;
+  uint64_t position = 0;
+  bool corrupt = false;
+};
+
+// Struct to hold the ring pair of one connection
+struct SharedRings {
+  void *memory = nullptr;
+  SharedRing requests; // Client to server
+  SharedRing replies;  // Server to client
+
+  bool attached() const { return memory != nullptr; }
+};
+
+// Size of the shared memory object holding a ring pair
+inline size_t sharedRingsSize() {
+  return 2 * sizeof(RingHeader) + 2 * ring_capacity;
+}
+
+// Function to check that path is a directory of this user that no other
+// user can enter
+inline bool privateDirectory(const std::string &path) {
+  struct stat status;
+  return lstat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode) &&
+         status.st_uid == geteuid() && (status.st_mode & 077) == 0;
+}
+
+// Function to get the path of the AF_UNIX socket of the server on a port,
+// in $XDG_RUNTIME_DIR or else in /tmp/HW2Server-<uid>, which the server
+// creates with mode 0700. Returns an empty string if the directory is not a
+// private one of this user or the path does not fit in a sockaddr_un
+inline std::string unixSocketPath(const std::string &port, bool create) {
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  std::string directory = runtime != nullptr && runtime[0] == '/'
+                              ? std::string(runtime)
+                              : "/tmp/HW2Server-" + std::to_string(geteuid());
+  if (create && runtime == nullptr) {
+    mkdir(directory.c_str(), 0700);
+  }
+  std::string path = directory + "/HW2Server." + port + ".sock";
+  if (!privateDirectory(directory) ||
+      path.size() >= sizeof(((struct sockaddr_un *)nullptr)->sun_path)) {
+    return "";
+  }
+  return path;
+}
+
+// Function to check that the process at the other end of an AF_UNIX socket
+// runs as this user
+inline bool peerIsUser(int fd) {
+  struct ucred credentials;
+  socklen_t length = sizeof(credentials);
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 &&
+         credentials.uid == geteuid();
+}
+
+// Function to check whether a connected socket is an AF_UNIX one
+inline bool isUnixSocket(int fd) {
+  struct sockaddr_storage address;
+  socklen_t length = sizeof(address);
+  return getsockname(fd, (struct sockaddr *)&address, &length) == 0 &&
+         address.ss_family == AF_UNIX;
+}
+
+// Function to check that the peer has not closed the socket, without
+// consuming anything from it
+inline bool peerConnected(int fd) {
+  char byte;
+  ssize_t n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+// Function to publish a move of cursor and wake its sleepers, if any
+inline void ringNotify(RingCursor &cursor, uint64_t position) {
+  __atomic_store_n(&cursor.position, position, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(&cursor.changes, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&cursor.sleepers, __ATOMIC_SEQ_CST) > 0) {
+    syscall(SYS_futex, &cursor.changes, FUTEX_WAKE, INT_MAX, nullptr, nullptr,
+            0);
+  }
+}
+
+// Function to sleep until cursor moves away from seen or closed is set.
+// Wakes up early now and then, returns false if the peer on fd is gone
+inline bool ringWait(RingCursor &cursor, uint64_t seen, const uint32_t &closed,
+                     int fd) {
+  uint32_t changes = __atomic_load_n(&cursor.changes, __ATOMIC_SEQ_CST);
+  auto moved = [&] {
+    return __atomic_load_n(&cursor.position, __ATOMIC_SEQ_CST) != seen ||
+           __atomic_load_n(&closed, __ATOMIC_SEQ_CST) != 0;
+  };
+  if (moved()) {
+    return true;
+  }
+  // Announcing the sleep before checking again means a move made after the
+  // check either changes the futex word first or sees the sleeper
+  __atomic_fetch_add(&cursor.sleepers, 1, __ATOMIC_SEQ_CST);
+  long result = 0;
+  if (!moved()) {
+    struct timespec timeout = {0, ring_timeout_ns};
+    result = syscall(SYS_futex, &cursor.changes, FUTEX_WAIT, changes, &timeout,
+                     nullptr, 0);
+  }
+  __atomic_fetch_sub(&cursor.sleepers, 1, __ATOMIC_SEQ_CST);
+  return result == 0 || errno != ETIMEDOUT || peerConnected(fd);
+}
+
+// Function to check the cursors of a ring, head may only run ahead of tail
+// by at most the whole ring. Marks the ring corrupt if it does not
+inline bool ringValid(SharedRing &ring, uint64_t head, uint64_t tail) {
+  if (tail > head || head - tail > ring_capacity) {
+    ring.corrupt = true;
+  }
+  return !ring.corrupt;
+}
+
+// Function to write a whole buffer to a ring, waiting for room as needed.
+// Returns false if the peer on fd is gone or corrupted the ring
+inline bool ringWrite(SharedRing &ring, const char *data, size_t size,
+                      int fd) {
+  RingHeader &header = *ring.header;
+  uint64_t &head = ring.position;
+  while (size > 0) {
+    uint64_t tail = __atomic_load_n(&header.tail.position, __ATOMIC_SEQ_CST);
+    if (!ringValid(ring, head, tail)) {
+      return false;
+    }
+    size_t room = ring_capacity - (head - tail);
+    if (room == 0) {
+      if (!ringWait(header.tail, tail, header.closed, fd)) {
+        return false;
+      }
+      continue;
+    }
+    size_t n = std::min({size, room, ring_capacity});
+    size_t offset = head % ring_capacity;
+    size_t first = std::min(n, ring_capacity - offset);
+    memcpy(ring.data + offset, data, first);
+    memcpy(ring.data, data + first, n - first);
+    head += n;
+    ringNotify(header.head, head);
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Function to read up to size bytes from a ring, waiting for at least one.
+// Returns 0 once the ring is closed and drained, the peer on fd is gone or
+// the peer corrupted the ring
+inline size_t ringRead(SharedRing &ring, char *data, size_t size, int fd) {
+  RingHeader &header = *ring.header;
+  uint64_t &tail = ring.position;
+  uint64_t head;
+  while ((head = __atomic_load_n(&header.head.position, __ATOMIC_SEQ_CST)) ==
+         tail) {
+    // The producer moves head before closing, so a closed ring is drained
+    // once head is read again after seeing closed
+    if (__atomic_load_n(&header.closed, __ATOMIC_SEQ_CST) != 0) {
+      head = __atomic_load_n(&header.head.position, __ATOMIC_SEQ_CST);
+      if (head == tail) {
+        return 0;
+      }
+      break;
+    }
+    if (!ringWait(header.head, tail, header.closed, fd)) {
+      return 0;
+    }
+  }
+  if (!ringValid(ring, head, tail)) {
+    return 0;
+  }
+  size_t n = std::min<uint64_t>({size, head - tail, ring_capacity});
+  size_t offset = tail % ring_capacity;
+  size_t first = std::min(n, ring_capacity - offset);
+  memcpy(data, ring.data + offset, first);
+  memcpy(data + first, ring.data, n - first);
+  tail += n;
+  ringNotify(header.tail, tail);
+  return n;
+}
+
+// Function to mark a ring as finished by its producer
+inline void ringClose(SharedRing &ring) {
+  __atomic_store_n(&ring.header->closed, 1, __ATOMIC_SEQ_CST);
+  ringNotify(ring.header->head, ring.position);
+}
+
+// Function to map a ring pair from an open shared memory object
+inline bool mapSharedRings(int shmfd, SharedRings &rings) {
+  void *memory = mmap(nullptr, sharedRingsSize(), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, shmfd, 0);
+  close(shmfd);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+  RingHeader *headers = static_cast<RingHeader *>(memory);
+  char *data = reinterpret_cast<char *>(headers + 2);
+  rings = SharedRings();
+  rings.memory = memory;
+  rings.requests.header = &headers[0];
+  rings.requests.data = data;
+  rings.replies.header = &headers[1];
+  rings.replies.data = data + ring_capacity;
+  return true;
+}
+
+// Function to create a zeroed ring pair under a new shared memory name
+inline bool createSharedRings(const std::string &name, SharedRings &rings) {
+  int shmfd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (shmfd < 0) {
+    return false;
+  }
+  if (ftruncate(shmfd, sharedRingsSize()) < 0) {
+    close(shmfd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  if (!mapSharedRings(shmfd, rings)) {
+    shm_unlink(name.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Function to map the ring pair another process created under name
+inline bool openSharedRings(const std::string &name, SharedRings &rings) {
+  int shmfd = shm_open(name.c_str(), O_RDWR, 0);
+  if (shmfd < 0) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(shmfd, &status) < 0 || (size_t)status.st_size != sharedRingsSize()) {
+    close(shmfd);
+    return false;
+  }
+  return mapSharedRings(shmfd, rings);
+}
+
+inline void unmapSharedRings(SharedRings &rings) {
+  if (rings.attached()) {
+    munmap(rings.memory, sharedRingsSize());
+    rings = SharedRings();
+  }
+}
+
+#endif